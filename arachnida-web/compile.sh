@@ -1,6 +1,9 @@
 #!/bin/bash
 
-g++ -std=c++17 -O2 -Wall -Wextra scorpion.cpp -lexiv2 -o scorpion_cpp
+g++ -std=c++17 -O2 -Wall -Wextra -pthread scorpion.cpp -lexiv2 -o scorpion_cpp
 gcc -std=c17 -O2 -Wall -Wextra scorpion.c $(pkg-config --cflags --libs gexiv2) -o scorpion_c                                                                                                                                  
 gcc -std=c17 -O2 -Wall -Wextra spider.c -lcurl -o spider_c
-g++ -std=c++17 -O2 -Wall -Wextra spider.cpp -lcurl -o spider_cpp
+g++ -std=c++20 -O2 -Wall -Wextra -pthread spider.cpp -lcurl -o spider_cpp
+g++ -std=c++20 -O2 -Wall -Wextra -pthread -DSPIDER_WITH_META spider.cpp -lcurl -lexiv2 -o spider_meta
+g++ -std=c++20 -O2 -Wall -Wextra -pthread spider_bench.cpp -lcurl -o spider_bench
+g++ -std=c++20 -O2 -Wall -Wextra -pthread spider_e2e_bench.cpp -lcurl -o spider_e2e_bench
@@ -1,102 +1,758 @@
-#include <exiv2/exiv2.hpp>
+#include "scorpion_meta.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <filesystem>
-#include <iomanip>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-namespace fs = std::filesystem;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static std::string human_size(uintmax_t bytes) {
-    const char* units[] = {"B","KB","MB","GB","TB"};
-    double v = (double)bytes;
-    int i = 0;
-    while (v >= 1024.0 && i < 4) { v /= 1024.0; i++; }
-    std::ostringstream oss;
-    if (i == 0) oss << (uintmax_t)v << " " << units[i];
-    else oss << std::fixed << std::setprecision(1) << v << " " << units[i];
-    return oss.str();
-}
+namespace fs = std::filesystem;
+using namespace meta;
 
-static void print_file_info(const fs::path& p) {
-    std::cout << "=== " << p.string() << "\n";
+static void stat_file(const fs::path& p, FileRecord& rec) {
     try {
         if (!fs::exists(p)) {
-            std::cout << "  !! file not found\n\n";
+            rec.errors.push_back("file not found");
             return;
         }
-        auto sz = fs::file_size(p);
-        std::cout << "- Size: " << human_size(sz) << "\n";
+        rec.size = fs::file_size(p);
+        rec.has_size = true;
     } catch (...) {
         // ignore
     }
 }
 
-static void dump_meta(const fs::path& p) {
-    try {
-        auto image = Exiv2::ImageFactory::open(p.string());
-        if (!image.get()) {
-            std::cout << "  !! cannot open as image\n\n";
-            return;
+enum class Format { Text, Ndjson, Columnar };
+
+struct MetaIndex;
+
+struct Options {
+    FieldFilter fields;
+    Format format = Format::Text;
+    bool mmap = false;   // --mmap: one open + map per file, Exiv2 reads from memory
+    MetaIndex* index = nullptr;   // --index FILE
+};
+
+/* ===================== Memory-mapped input (--mmap) ===================== */
+
+// A read-only mapping of a whole file. open() is the only filesystem
+// access: the size comes from the descriptor (no separate exists/stat by
+// path) and Exiv2 parses straight out of the mapping via MemIo.
+struct MappedFile {
+    int fd = -1;
+    const Exiv2::byte* data = nullptr;
+    size_t size = 0;
+    int err = 0;   // errno of a failed open; 0 for a non-regular file
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const fs::path& p) {
+        fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) return fail();
+        if (!S_ISREG(st.st_mode)) {
+            close();
+            return false;   // err stays 0
+        }
+        size = (size_t)st.st_size;
+        if (size == 0) return true;   // nothing to map; Exiv2 rejects it below
+        void* m = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) return fail();
+        data = static_cast<const Exiv2::byte*>(m);
+        return true;
+    }
+
+    void close() {
+        if (data) ::munmap(const_cast<Exiv2::byte*>(data), size);
+        if (fd >= 0) ::close(fd);
+        data = nullptr;
+        fd = -1;
+    }
+
+private:
+    bool fail() {
+        err = errno;
+        close();
+        return false;
+    }
+};
+
+/* ===================== Metadata ===================== */
+
+static FileRecord scan_file(const fs::path& p, const Options& opt) {
+    FileRecord rec;
+    rec.path = p.string();
+    if (!opt.mmap) {
+        stat_file(p, rec);
+        read_meta(MetaSource::from_file(p), opt.fields, rec);
+        return rec;
+    }
+    MappedFile map;
+    if (!map.open(p)) {
+        if (map.err == ENOENT) rec.errors.push_back("file not found");
+        else if (map.err == 0) rec.errors.push_back("not a regular file");
+        else rec.errors.push_back(std::string("cannot open: ") + std::strerror(map.err));
+        return rec;
+    }
+    rec.size = map.size;
+    rec.has_size = true;
+    read_meta(MetaSource::from_memory(map.data, map.size), opt.fields, rec);
+    return rec;
+}
+
+/* ===================== Output (--format) ===================== */
+
+static void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static void put_str(std::string& out, std::string_view s) {
+    put_varint(out, s.size());
+    out.append(s.data(), s.size());
+}
+
+// --format columnar: a compact binary stream for bulk loading, laid out
+// like Arrow record batches (one buffer per column) without depending on
+// Arrow or Parquet. Metadata key names are interned: each distinct key is
+// written once, rows refer to it by id.
+//
+//   stream := "SCORPC1\n" block* 'E'
+//   block  := 'K' varint(n) str{n}             keys new since the last block,
+//                                              ids continue from the previous
+//           | 'B' varint(rows) col{8}          up to batch_rows files
+//   col    := varint(byte length) bytes        (skippable)
+//   str    := varint(length) bytes
+//
+// Columns, in order:
+//   path     str per row
+//   size     varint(size + 1) per row, 0 = unknown
+//   flags    byte per row: 1 metadata read, 2 date selected,
+//            4/8/16 EXIF/XMP/IPTC section selected
+//   errors   varint(n) str{n} per row
+//   date     varint(key id + 1) per row, 0 = none; then str if non-zero
+//   counts   varint per selected section per row (field count)
+//   keys     varint key id per field
+//   values   str per field
+struct ColumnarWriter {
+    static constexpr size_t batch_rows = 4096;
+    enum { Path, Size, Flags, Errors, Date, Counts, Keys, Values, NumCols };
+
+    std::unordered_map<std::string, uint64_t> ids;
+    std::vector<std::string_view> fresh;   // keys of `ids` not yet written
+    std::string cols[NumCols];             // reused across batches
+    size_t rows = 0;
+
+    uint64_t intern(const std::string& key) {
+        auto [it, added] = ids.emplace(key, ids.size());
+        if (added) fresh.push_back(it->first);
+        return it->second;
+    }
+
+    void add(std::string& out, const FileRecord& r) {
+        put_str(cols[Path], r.path);
+        put_varint(cols[Size], r.has_size ? r.size + 1 : 0);
+
+        unsigned flags = (r.meta ? 1u : 0u) | (r.meta && r.want_date ? 2u : 0u);
+        for (int s = 0; s < 3; ++s) {
+            if (r.meta && r.sections[s].shown) flags |= 4u << s;
+        }
+        cols[Flags].push_back((char)flags);
+
+        put_varint(cols[Errors], r.errors.size());
+        for (const auto& e : r.errors) put_str(cols[Errors], e);
+
+        if (r.meta && r.want_date && !r.date_key.empty()) {
+            put_varint(cols[Date], intern(r.date_key) + 1);
+            put_str(cols[Date], r.date);
+        } else {
+            put_varint(cols[Date], 0);
+        }
+
+        for (int s = 0; s < 3; ++s) {
+            if (!(flags & (4u << s))) continue;
+            const auto& fields = r.sections[s].fields;
+            put_varint(cols[Counts], fields.size());
+            for (const auto& [k, v] : fields) {
+                put_varint(cols[Keys], intern(k));
+                put_str(cols[Values], v);
+            }
+        }
+
+        if (++rows == batch_rows) flush_batch(out);
+    }
+
+    void flush_batch(std::string& out) {
+        if (!fresh.empty()) {
+            out.push_back('K');
+            put_varint(out, fresh.size());
+            for (auto k : fresh) put_str(out, k);
+            fresh.clear();
+        }
+        if (rows == 0) return;
+        out.push_back('B');
+        put_varint(out, rows);
+        for (auto& c : cols) {
+            put_str(out, c);
+            c.clear();
+        }
+        rows = 0;
+    }
+
+    void finish(std::string& out) {
+        flush_batch(out);
+        out.push_back('E');
+    }
+};
+
+// Renders records, in input order, into one large buffer that is reused
+// for the whole run and handed to fwrite once it passes `flush_at`, so
+// there is no per-field iostream work.
+struct RecordSink {
+    static constexpr size_t flush_at = 1 << 20;
+
+    Format format;
+    std::string buf;
+    ColumnarWriter columnar;
+
+    explicit RecordSink(Format f) : format(f) {
+        buf.reserve(flush_at + (flush_at >> 2));
+        if (format == Format::Columnar) buf += "SCORPC1\n";
+    }
+
+    void write(const FileRecord& r) {
+        switch (format) {
+        case Format::Text:     write_text(buf, r); break;
+        case Format::Ndjson:   write_ndjson(buf, r); break;
+        case Format::Columnar: columnar.add(buf, r); break;
+        }
+        if (buf.size() >= flush_at) flush();
+    }
+
+    void finish() {
+        if (format == Format::Columnar) columnar.finish(buf);
+        flush();
+        std::fflush(stdout);
+    }
+
+    void flush() {
+        if (!buf.empty()) std::fwrite(buf.data(), 1, buf.size(), stdout);
+        buf.clear();
+    }
+};
+
+/* ===================== Metadata index (--index) ===================== */
+
+static bool get_varint(std::string_view& in, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+        unsigned char b = (unsigned char)in.front();
+        in.remove_prefix(1);
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (b < 0x80) return true;
+    }
+    return false;
+}
+
+static bool get_str(std::string_view& in, std::string& s) {
+    uint64_t n;
+    if (!get_varint(in, n) || n > in.size()) return false;
+    s.assign(in.data(), (size_t)n);
+    in.remove_prefix((size_t)n);
+    return true;
+}
+
+// What an index entry is keyed on, besides the path.
+struct FileStamp {
+    uint64_t size = 0;
+    uint64_t mtime_ns = 0;
+
+    bool operator==(const FileStamp& o) const { return size == o.size && mtime_ns == o.mtime_ns; }
+};
+
+static bool stamp_file(const fs::path& p, FileStamp& st) {
+    struct stat sb;
+    if (::stat(p.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode)) return false;
+    st.size = (uint64_t)sb.st_size;
+    st.mtime_ns = (uint64_t)sb.st_mtim.tv_sec * 1000000000u + (uint64_t)sb.st_mtim.tv_nsec;
+    return true;
+}
+
+static void encode_record(std::string& out, const FileRecord& r) {
+    put_varint(out, r.has_size ? r.size + 1 : 0);
+    put_varint(out, r.errors.size());
+    for (const auto& e : r.errors) put_str(out, e);
+    unsigned flags = (r.meta ? 1u : 0u) | (r.want_date ? 2u : 0u);
+    for (int s = 0; s < 3; ++s) {
+        if (r.sections[s].shown) flags |= 4u << s;
+    }
+    put_varint(out, flags);
+    put_str(out, r.date);
+    put_str(out, r.date_key);
+    for (const auto& sec : r.sections) {
+        put_varint(out, sec.fields.size());
+        for (const auto& [k, v] : sec.fields) {
+            put_str(out, k);
+            put_str(out, v);
+        }
+    }
+}
+
+static bool decode_record(std::string_view& in, FileRecord& r) {
+    uint64_t size, n, flags;
+    if (!get_varint(in, size) || !get_varint(in, n)) return false;
+    r.has_size = size != 0;
+    r.size = size ? size - 1 : 0;
+    r.errors.resize((size_t)std::min<uint64_t>(n, in.size()));
+    for (auto& e : r.errors) {
+        if (!get_str(in, e)) return false;
+    }
+    if (!get_varint(in, flags) || !get_str(in, r.date) || !get_str(in, r.date_key)) return false;
+    r.meta = flags & 1;
+    r.want_date = flags & 2;
+    for (int s = 0; s < 3; ++s) {
+        auto& sec = r.sections[s];
+        sec.shown = flags & (4u << s);
+        if (!get_varint(in, n)) return false;
+        sec.fields.resize((size_t)std::min<uint64_t>(n, in.size()));
+        for (auto& [k, v] : sec.fields) {
+            if (!get_str(in, k) || !get_str(in, v)) return false;
         }
-        image->readMetadata();
+    }
+    return true;
+}
+
+// Records from earlier runs, keyed by path and valid while the file's size
+// and mtime are unchanged, so a rescan of a mostly unchanged archive only
+// opens new or modified files. The file starts with the read mode and
+// --fields selection it was built with ("mmap:" or "read:", then the
+// globs); a run with a different one starts afresh, as --mmap parses
+// through a different Exiv2 path. Records with errors are never kept, so
+// a transient failure (EACCES, EIO, an Exiv2 exception) is retried.
+//
+//   "SCORPIX1\n" str(selection) { str(path) varint(size) varint(mtime_ns) record }*
+struct MetaIndex {
+    struct Entry {
+        FileStamp stamp;
+        FileRecord rec;
+        bool seen = false;   // looked up or stored this run
+    };
 
-        const auto& exif = image->exifData();
-        const auto& xmp  = image->xmpData();
-        const auto& iptc = image->iptcData();
+    fs::path file;
+    std::string selection;
+    std::mutex mu;
+    std::unordered_map<std::string, Entry> entries;
+    bool dirty = false;
+    std::atomic<size_t> hits{0}, misses{0};
 
-        // Prefer EXIF dates
-        auto print_date = [&](const char* key) -> bool {
-            auto it = exif.findKey(Exiv2::ExifKey(key));
-            if (it != exif.end()) {
-                std::cout << "- EXIF date: " << it->toString() << " (" << key << ")\n";
-                return true;
+    // A missing or unreadable index is not an error: it is rebuilt.
+    void load(const fs::path& f, std::string sel) {
+        file = f;
+        selection = std::move(sel);
+        std::ifstream in(file, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::string_view v(data);
+        std::string stored;
+        if (v.substr(0, 9) != "SCORPIX1\n") return;
+        v.remove_prefix(9);
+        if (!get_str(v, stored) || stored != selection) {
+            dirty = true;   // rewritten with the new selection
+            return;
+        }
+        while (!v.empty()) {
+            std::string path;
+            Entry e;
+            if (!get_str(v, path) || !get_varint(v, e.stamp.size) || !get_varint(v, e.stamp.mtime_ns) ||
+                !decode_record(v, e.rec)) {
+                std::cerr << "Index " << file.string() << " is truncated; keeping "
+                          << entries.size() << " entries\n";
+                dirty = true;
+                break;
             }
+            e.rec.path = path;
+            entries[std::move(path)] = std::move(e);
+        }
+    }
+
+    bool lookup(const std::string& path, const FileStamp& st, FileRecord& rec) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = entries.find(path);
+        if (it == entries.end() || !(it->second.stamp == st)) {
+            ++misses;
             return false;
-        };
-        if (!(print_date("Exif.Photo.DateTimeOriginal") ||
-              print_date("Exif.Photo.DateTimeDigitized") ||
-              print_date("Exif.Image.DateTime"))) {
-            std::cout << "- EXIF date: (not found)\n";
         }
+        it->second.seen = true;
+        rec = it->second.rec;
+        ++hits;
+        return true;
+    }
+
+    void store(const std::string& path, const FileStamp& st, const FileRecord& rec) {
+        std::lock_guard<std::mutex> lock(mu);
+        Entry& e = entries[path];
+        e.stamp = st;
+        e.rec = rec;
+        e.seen = true;
+        dirty = true;
+    }
 
-        std::cout << "\n[EXIF]\n";
-        if (exif.empty()) std::cout << "(no EXIF)\n";
-        for (const auto& md : exif) {
-            std::cout << md.key() << ": " << md.toString() << "\n";
+    // Rewrites the index (temp file + rename) if anything changed. Entries
+    // not visited this run are kept unless their file is gone, so scanning
+    // part of an archive does not forget the rest.
+    bool save() {
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto it = entries.begin(); it != entries.end();) {
+            std::error_code ec;
+            if (!it->second.seen && !fs::exists(it->first, ec)) {
+                it = entries.erase(it);
+                dirty = true;
+            } else {
+                ++it;
+            }
         }
+        if (!dirty) return true;
+
+        std::string out = "SCORPIX1\n";
+        put_str(out, selection);
+        for (const auto& [path, e] : entries) {
+            put_str(out, path);
+            put_varint(out, e.stamp.size);
+            put_varint(out, e.stamp.mtime_ns);
+            encode_record(out, e.rec);
+        }
+        fs::path tmp = file;
+        tmp += ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            f.write(out.data(), (std::streamsize)out.size());
+            if (!f) return false;
+        }
+        std::error_code ec;
+        fs::rename(tmp, file, ec);
+        if (ec) return false;
+        dirty = false;
+        return true;
+    }
+};
+
+// Index in front of scan_file(): a hit costs one stat and no open.
+static FileRecord scan_indexed(const fs::path& p, const Options& opt) {
+    FileStamp st;
+    if (!opt.index || !stamp_file(p, st)) return scan_file(p, opt);
+    FileRecord rec;
+    if (opt.index->lookup(p.string(), st, rec)) return rec;
+    rec = scan_file(p, opt);
+    if (rec.errors.empty()) opt.index->store(rec.path, st, rec);
+    return rec;
+}
+
+/* ===================== Inputs ===================== */
+
+struct Inputs {
+    std::vector<std::pair<bool, fs::path>> items;   // (is -R directory, path)
+    bool magic = false;                             // filter -R files by content
+};
+
+static bool has_image_ext(const fs::path& p) {
+    std::string ext = p.extension().string();
+    for (char& c : ext) c = (char)std::tolower((unsigned char)c);
+    static const char* exts[] = {".jpg", ".jpeg", ".png", ".gif", ".bmp"};
+    for (const char* e : exts) {
+        if (ext == e) return true;
+    }
+    return false;
+}
+
+static bool has_image_magic(const fs::path& p) {
+    char head[8] = {};
+    std::ifstream in(p, std::ios::binary);
+    in.read(head, sizeof(head));
+    std::string_view h(head, (size_t)in.gcount());
+    return h.substr(0, 3) == std::string_view("\xFF\xD8\xFF", 3) ||
+           h.substr(0, 8) == std::string_view("\x89PNG\r\n\x1A\n", 8) ||
+           h.substr(0, 6) == "GIF87a" || h.substr(0, 6) == "GIF89a" ||
+           h.substr(0, 2) == "BM";
+}
 
-        std::cout << "\n[XMP]\n";
-        if (xmp.empty()) std::cout << "(no XMP)\n";
-        for (const auto& md : xmp) {
-            std::cout << md.key() << ": " << md.toString() << "\n";
+// Calls `emit` for every input in order. Directories are walked lazily,
+// so the first file is handed on before the rest of the tree is listed;
+// unreadable subdirectories are skipped.
+static void for_each_input(const Inputs& in, const std::function<void(fs::path)>& emit) {
+    for (const auto& [recursive, path] : in.items) {
+        if (!recursive) {
+            emit(path);
+            continue;
+        }
+        std::error_code ec;
+        fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, ec), end;
+        if (ec) {
+            std::cerr << "Cannot read directory: " << path.string() << " (" << ec.message() << ")\n";
+            continue;
+        }
+        for (; it != end; it.increment(ec)) {
+            if (ec) continue;
+            std::error_code fec;
+            if (!it->is_regular_file(fec)) continue;
+            const fs::path& f = it->path();
+            if (in.magic ? has_image_magic(f) : has_image_ext(f)) emit(f);
         }
+    }
+}
+
+/* ===================== Parallel mode (-j N) ===================== */
+
+// Paths from the producer (argument list / directory walk) to the
+// workers, numbered in input order. Bounded, so a huge tree never sits
+// in memory: the walk simply waits for the workers.
+struct PathChannel {
+    std::mutex mu;
+    std::condition_variable not_empty, not_full;
+    std::deque<std::pair<size_t, fs::path>> q;
+    size_t capacity;
+    bool closed = false;
+
+    explicit PathChannel(size_t cap) : capacity(std::max<size_t>(1, cap)) {}
 
-        std::cout << "\n[IPTC]\n";
-        if (iptc.empty()) std::cout << "(no IPTC)\n";
-        for (const auto& md : iptc) {
-            std::cout << md.key() << ": " << md.toString() << "\n";
+    void push(size_t idx, fs::path p) {
+        std::unique_lock<std::mutex> lock(mu);
+        not_full.wait(lock, [&] { return q.size() < capacity; });
+        q.emplace_back(idx, std::move(p));
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            closed = true;
         }
+        not_empty.notify_all();
+    }
 
-        std::cout << "\n";
-    } catch (const Exiv2::Error& e) {
-        std::cout << "  !! metadata read error: " << e.what() << "\n\n";
-    } catch (const std::exception& e) {
-        std::cout << "  !! error: " << e.what() << "\n\n";
+    // False once closed and drained.
+    bool pop(size_t& idx, fs::path& p) {
+        std::unique_lock<std::mutex> lock(mu);
+        not_empty.wait(lock, [&] { return !q.empty() || closed; });
+        if (q.empty()) return false;
+        idx = q.front().first;
+        p = std::move(q.front().second);
+        q.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return true;
     }
+};
+
+// Finished records waiting for their turn. Workers scan files in any
+// order; the printing thread writes them strictly in input order (which
+// is also what the columnar key dictionary relies on). A worker may only
+// start file `idx` once idx < next + window, so at most `window` reports
+// are ever buffered.
+struct ReorderBuffer {
+    std::mutex mu;
+    std::condition_variable ready;   // a report arrived, or the input ended
+    std::condition_variable space;   // `next` moved on
+    std::map<size_t, FileRecord> done;
+    size_t next = 0;
+    size_t total = SIZE_MAX;         // known once the producer is done
+    size_t window;
+
+    explicit ReorderBuffer(size_t w) : window(std::max<size_t>(1, w)) {}
+
+    void wait_turn(size_t idx) {
+        std::unique_lock<std::mutex> lock(mu);
+        space.wait(lock, [&] { return idx < next + window; });
+    }
+
+    void put(size_t idx, FileRecord rec) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            done.emplace(idx, std::move(rec));
+        }
+        ready.notify_one();
+    }
+
+    void finish(size_t count) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            total = count;
+        }
+        ready.notify_one();
+    }
+
+    // Writes records in order until all `total` have gone out.
+    void drain(RecordSink& sink) {
+        std::unique_lock<std::mutex> lock(mu);
+        for (;;) {
+            ready.wait(lock, [&] { return done.count(next) != 0 || next >= total; });
+            if (next >= total) break;
+            auto node = done.extract(next);
+            ++next;
+            lock.unlock();
+            space.notify_all();
+            sink.write(node.mapped());
+            lock.lock();
+        }
+    }
+};
+
+static void run_parallel(const Inputs& inputs, const Options& opt, int jobs, RecordSink& sink) {
+    // Exiv2's XMP toolkit must be set up once before threads use it
+    Exiv2::XmpParser::initialize();
+
+    PathChannel paths((size_t)jobs * 4);
+    ReorderBuffer out((size_t)jobs * 4);
+
+    std::thread producer([&] {
+        size_t n = 0;
+        for_each_input(inputs, [&](fs::path p) { paths.push(n++, std::move(p)); });
+        paths.close();
+        out.finish(n);
+    });
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < jobs; ++t) {
+        workers.emplace_back([&] {
+            size_t idx;
+            fs::path p;
+            while (paths.pop(idx, p)) {
+                out.wait_turn(idx);
+                out.put(idx, scan_indexed(p, opt));
+            }
+        });
+    }
+    out.drain(sink);
+    producer.join();
+    for (auto& w : workers) w.join();
+
+    Exiv2::XmpParser::terminate();
+}
+
+static void usage() {
+    std::cerr << "Usage: ./scorpion [-j N] [--magic] [--mmap] [--format F] [--fields LIST] [--index FILE] [-R DIR]... [FILE]...\n"
+              << "  -j N      parse N files at a time (output stays in input order)\n"
+              << "  -R DIR    every image under DIR, recursively (by extension)\n"
+              << "  --magic   pick -R files by their leading bytes instead of extension\n"
+              << "  --mmap    map each file once and parse it from memory\n"
+              << "  --format F     text (default), ndjson (one JSON object per file)\n"
+              << "                 or columnar (compact binary batches)\n"
+              << "  --fields LIST  print only these keys: comma-separated globs,\n"
+              << "                 e.g. Exif.Photo.DateTimeOriginal,Exif.GPSInfo.*\n"
+              << "  --index FILE   reuse metadata of files whose size and mtime are\n"
+              << "                 unchanged since the last run; FILE is updated\n";
 }
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: ./scorpion FILE1 [FILE2 ...]\n";
+    int jobs = 1;
+    Inputs inputs;
+    Options opt;
+    std::string index_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "-j") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for -j\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos || std::stoi(n) < 1) {
+                std::cerr << "Invalid value for -j: " << n << "\n";
+                return 1;
+            }
+            jobs = std::stoi(n);
+        } else if (a == "-R") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for -R\n";
+                usage();
+                return 1;
+            }
+            inputs.items.emplace_back(true, argv[++i]);
+        } else if (a == "--magic") {
+            inputs.magic = true;
+        } else if (a == "--format") {
+            std::string f = i + 1 < argc ? argv[++i] : "";
+            if (f == "text") opt.format = Format::Text;
+            else if (f == "ndjson") opt.format = Format::Ndjson;
+            else if (f == "columnar") opt.format = Format::Columnar;
+            else {
+                std::cerr << "Invalid value for --format: " << f << " (text, ndjson or columnar)\n";
+                return 1;
+            }
+        } else if (a == "--index") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --index\n";
+                usage();
+                return 1;
+            }
+            index_path = argv[++i];
+        } else if (a == "--mmap") {
+            opt.mmap = true;
+        } else if (a == "--fields") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --fields\n";
+                usage();
+                return 1;
+            }
+            opt.fields = parse_fields(argv[++i]);
+        } else {
+            inputs.items.emplace_back(false, a);
+        }
+    }
+    if (inputs.items.empty()) {
+        usage();
         return 1;
     }
 
-    for (int i = 1; i < argc; ++i) {
-        fs::path p = argv[i];
-        print_file_info(p);
-        dump_meta(p);
+    MetaIndex index;
+    if (!index_path.empty()) {
+        std::string selection = opt.mmap ? "mmap:" : "read:";
+        for (size_t g = 0; g < opt.fields.globs.size(); ++g) selection += (g ? "," : "") + opt.fields.globs[g];
+        index.load(index_path, selection);
+        opt.index = &index;
+    }
+
+    bool single = inputs.items.size() == 1 && !inputs.items[0].first;
+    RecordSink sink(opt.format);
+    if (jobs <= 1 || single) {
+        for_each_input(inputs, [&](fs::path p) { sink.write(scan_indexed(p, opt)); });
+    } else {
+        run_parallel(inputs, opt, jobs, sink);
+    }
+    sink.finish();
+
+    if (opt.index) {
+        std::cerr << "Index: " << index.hits << " cached, " << index.misses << " scanned\n";
+        if (!index.save()) {
+            std::cerr << "Cannot write index: " << index_path << "\n";
+            return 1;
+        }
     }
     return 0;
 }
-
@@ -0,0 +1,436 @@
+// Metadata extraction shared by scorpion and spider's --meta pipeline
+// (built with -DSPIDER_WITH_META): field selection, the Exiv2 read (from
+// a file or from memory) and the text / NDJSON record writers.
+#pragma once
+
+#include <exiv2/exiv2.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace meta {
+
+namespace fs = std::filesystem;
+
+// Everything scorpion reports about one file: filled in by read_meta()
+// (scorpion's scan_file(), spider's --meta workers), rendered by one of
+// the writers below or scorpion's --format writers.
+struct FileRecord {
+    enum { Exif, Xmp, Iptc };
+    struct Section {
+        bool shown = false;   // selected by --fields (listed even when empty)
+        std::vector<std::pair<std::string, std::string>> fields;
+    };
+
+    std::string path;                  // may be empty for a body never saved
+    std::string url;                   // spider --meta: where it was downloaded from
+    bool has_size = false;
+    uint64_t size = 0;
+    std::vector<std::string> errors;   // "file not found", "metadata read error: ...", ...
+    bool meta = false;                 // metadata was read
+    bool want_date = false;            // date line selected
+    std::string date, date_key;        // date_key empty: no EXIF date
+    Section sections[3];
+};
+
+inline std::string human_size(uintmax_t bytes) {
+    const char* units[] = {"B","KB","MB","GB","TB"};
+    double v = (double)bytes;
+    int i = 0;
+    while (v >= 1024.0 && i < 4) { v /= 1024.0; i++; }
+    char buf[32];
+    if (i == 0) std::snprintf(buf, sizeof(buf), "%ju %s", (uintmax_t)v, units[i]);
+    else std::snprintf(buf, sizeof(buf), "%.1f %s", v, units[i]);
+    return buf;
+}
+
+/* ===================== Field selection ===================== */
+
+// '*' matches any run of characters (dots included), '?' any one.
+inline bool glob_match(std::string_view pat, std::string_view s) {
+    size_t p = 0, i = 0, star = std::string_view::npos, mark = 0;
+    while (i < s.size()) {
+        if (p < pat.size() && (pat[p] == '?' || pat[p] == s[i])) {
+            ++p;
+            ++i;
+        } else if (p < pat.size() && pat[p] == '*') {
+            star = p++;
+            mark = i;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            i = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pat.size() && pat[p] == '*') ++p;
+    return p == pat.size();
+}
+
+struct FieldFilter {
+    std::vector<std::string> globs;   // empty: every field
+
+    bool all() const { return globs.empty(); }
+
+    bool match(std::string_view key) const {
+        if (globs.empty()) return true;
+        for (const auto& g : globs) {
+            if (glob_match(g, key)) return true;
+        }
+        return false;
+    }
+
+    // Whether any key of `family` ("Exif", "Xmp", "Iptc") can match, so
+    // whole metadata blocks can be left unparsed.
+    bool wants(std::string_view family) const {
+        if (globs.empty()) return true;
+        std::string fam = std::string(family) + ".";
+        for (const auto& g : globs) {
+            std::string_view lit(g);
+            lit = lit.substr(0, std::min(lit.find_first_of("*?"), lit.size()));
+            std::string_view f(fam);
+            bool overlap = lit.size() >= f.size() ? lit.substr(0, f.size()) == f
+                                                  : f.substr(0, lit.size()) == lit;
+            if (overlap) return true;
+        }
+        return false;
+    }
+};
+
+// "Exif.Photo.DateTimeOriginal,Exif.GPSInfo.*" -> one glob per item.
+inline FieldFilter parse_fields(std::string_view list) {
+    FieldFilter f;
+    while (!list.empty()) {
+        size_t comma = std::min(list.find(','), list.size());
+        std::string_view item = list.substr(0, comma);
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (!item.empty()) f.globs.emplace_back(item);
+        list.remove_prefix(std::min(comma + 1, list.size()));
+    }
+    return f;
+}
+
+/* ===================== Extraction ===================== */
+
+// Reads only the Exif APP1 segment of a JPEG: walks the marker headers up
+// to the first scan and seeks over every other segment, so XMP and IPTC
+// blocks are never read, let alone parsed. False if `p` is not a JPEG.
+inline bool read_jpeg_exif(const fs::path& p, Exiv2::ExifData& exif) {
+    std::ifstream in(p, std::ios::binary);
+    if (in.get() != 0xFF || in.get() != 0xD8) return false;
+
+    for (;;) {
+        if (in.get() != 0xFF) break;   // lost sync: keep what we have
+        int marker;
+        do marker = in.get(); while (marker == 0xFF);   // fill bytes
+        if (marker == EOF || marker == 0xD9 || marker == 0xDA) break;   // EOI / SOS
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;   // no length
+
+        int hi = in.get(), lo = in.get();
+        if (lo == EOF) break;
+        size_t len = (size_t)hi << 8 | (size_t)lo;
+        if (len < 2) break;
+        len -= 2;
+
+        if (marker == 0xE1 && len > 6 && exif.empty()) {
+            // APP1 is also XMP: only the signature is read before deciding
+            char sig[6];
+            if (!in.read(sig, 6)) break;
+            len -= 6;
+            if (std::string_view(sig, 6) != std::string_view("Exif\0\0", 6)) {
+                in.seekg((std::streamoff)len, std::ios::cur);
+                continue;
+            }
+            std::vector<char> seg(len);
+            if (!in.read(seg.data(), (std::streamsize)len)) break;
+            Exiv2::ExifParser::decode(exif, reinterpret_cast<const Exiv2::byte*>(seg.data()), (uint32_t)len);
+        } else {
+            in.seekg((std::streamoff)len, std::ios::cur);
+        }
+    }
+    return true;
+}
+
+// Same walk as read_jpeg_exif over a buffer; sets `exif_off`/`exif_len`
+// to the Exif payload (after "Exif\0\0"), len 0 if there is none. False if
+// the buffer is not a JPEG.
+inline bool find_jpeg_exif(const Exiv2::byte* d, size_t n, size_t& exif_off, size_t& exif_len) {
+    exif_off = exif_len = 0;
+    if (n < 2 || d[0] != 0xFF || d[1] != 0xD8) return false;
+
+    size_t i = 2;
+    while (i < n && d[i] == 0xFF) {
+        while (i < n && d[i] == 0xFF) ++i;   // fill bytes
+        if (i >= n) break;
+        int marker = d[i++];
+        if (marker == 0xD9 || marker == 0xDA) break;   // EOI / SOS
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;   // no length
+        if (i + 2 > n) break;
+        size_t len = (size_t)d[i] << 8 | d[i + 1];
+        if (len < 2 || i + len > n) break;
+        if (marker == 0xE1 && len > 8 && std::memcmp(d + i + 2, "Exif\0\0", 6) == 0) {
+            exif_off = i + 8;
+            exif_len = len - 8;
+            break;
+        }
+        i += len;
+    }
+    return true;
+}
+
+template <typename Data>
+inline void collect_section(const Data& data, const FieldFilter& fields, FileRecord::Section& out) {
+    out.shown = true;
+    for (const auto& md : data) {
+        std::string key = md.key();
+        // toString() is the expensive part; only selected fields pay for it
+        if (!fields.match(key)) continue;
+        out.fields.emplace_back(std::move(key), md.toString());
+    }
+}
+
+// Where read_meta() parses from: a file by path, or bytes already in
+// memory (a mapping, a downloaded body), which Exiv2 reads through MemIo
+// in place.
+struct MetaSource {
+    const fs::path* file = nullptr;
+    const Exiv2::byte* data = nullptr;
+    size_t size = 0;
+
+    static MetaSource from_file(const fs::path& p) {
+        MetaSource s;
+        s.file = &p;
+        return s;
+    }
+    static MetaSource from_memory(const void* data, size_t size) {
+        MetaSource s;
+        s.data = static_cast<const Exiv2::byte*>(data);
+        s.size = size;
+        return s;
+    }
+};
+
+// Fills the metadata part of `rec` (errors, date, selected sections).
+inline void read_meta(const MetaSource& src, const FieldFilter& fields, FileRecord& rec) {
+    static const char* date_keys[] = {
+        "Exif.Photo.DateTimeOriginal", "Exif.Photo.DateTimeDigitized", "Exif.Image.DateTime"
+    };
+    try {
+        // EXIF-only selections of a JPEG skip Exiv2's full read (and the
+        // XMP parse that dominates it)
+        Exiv2::ExifData own_exif;
+        decltype(Exiv2::ImageFactory::open(std::string())) image;   // AutoPtr (0.27) / UniquePtr (0.28)
+        bool fast = !fields.all() && !fields.wants("Xmp") && !fields.wants("Iptc");
+        if (fast && !src.file) {
+            size_t off, len;
+            fast = find_jpeg_exif(src.data, src.size, off, len);
+            if (fast && len) Exiv2::ExifParser::decode(own_exif, src.data + off, (uint32_t)len);
+        } else if (fast) {
+            fast = read_jpeg_exif(*src.file, own_exif);
+        }
+        if (!fast) {
+            static const Exiv2::byte empty = 0;
+            image = src.file ? Exiv2::ImageFactory::open(src.file->string())
+                             : Exiv2::ImageFactory::open(src.data ? src.data : &empty, src.size);
+            if (!image.get()) {
+                rec.errors.push_back("cannot open as image");
+                return;
+            }
+            image->readMetadata();
+        }
+        const auto& exif = fast ? own_exif : image->exifData();
+
+        FileRecord r;
+        r.want_date = fields.all();
+        for (const char* k : date_keys) r.want_date = r.want_date || fields.match(k);
+        if (r.want_date) {
+            // Prefer EXIF dates
+            for (const char* key : date_keys) {
+                auto it = exif.findKey(Exiv2::ExifKey(key));
+                if (it != exif.end()) {
+                    r.date = it->toString();
+                    r.date_key = key;
+                    break;
+                }
+            }
+        }
+
+        if (fields.wants("Exif")) collect_section(exif, fields, r.sections[FileRecord::Exif]);
+        if (!fast && fields.wants("Xmp")) collect_section(image->xmpData(), fields, r.sections[FileRecord::Xmp]);
+        if (!fast && fields.wants("Iptc")) collect_section(image->iptcData(), fields, r.sections[FileRecord::Iptc]);
+
+        // only a complete read is kept
+        rec.meta = true;
+        rec.want_date = r.want_date;
+        rec.date = std::move(r.date);
+        rec.date_key = std::move(r.date_key);
+        for (int s = 0; s < 3; ++s) rec.sections[s] = std::move(r.sections[s]);
+    } catch (const Exiv2::Error& e) {
+        rec.errors.push_back(std::string("metadata read error: ") + e.what());
+    } catch (const std::exception& e) {
+        rec.errors.push_back(std::string("error: ") + e.what());
+    }
+}
+
+/* ===================== Writers ===================== */
+
+inline void put_uint(std::string& out, uint64_t v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, (size_t)(r.ptr - buf));
+}
+
+inline void json_escape(std::string& out, std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : s) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                out += "\\u00";
+                out.push_back(hex[(unsigned char)c >> 4]);
+                out.push_back(hex[c & 0xF]);
+            } else {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+inline const char* const section_titles[] = {"EXIF", "XMP", "IPTC"};
+inline const char* const section_names[] = {"exif", "xmp", "iptc"};
+
+// scorpion's human-readable dump.
+inline void write_text(std::string& out, const FileRecord& r) {
+    out += "=== ";
+    out += r.path;
+    out += "\n";
+    if (r.has_size) {
+        out += "- Size: ";
+        out += human_size(r.size);
+        out += "\n";
+    }
+    for (const auto& e : r.errors) {
+        out += "  !! ";
+        out += e;
+        out += "\n\n";
+    }
+    if (!r.meta) return;
+
+    if (r.want_date) {
+        if (r.date_key.empty()) {
+            out += "- EXIF date: (not found)\n";
+        } else {
+            out += "- EXIF date: ";
+            out += r.date;
+            out += " (";
+            out += r.date_key;
+            out += ")\n";
+        }
+    }
+    for (int s = 0; s < 3; ++s) {
+        const auto& sec = r.sections[s];
+        if (!sec.shown) continue;
+        out += "\n[";
+        out += section_titles[s];
+        out += "]\n";
+        if (sec.fields.empty()) {
+            out += "(no ";
+            out += section_titles[s];
+            out += ")\n";
+        }
+        for (const auto& [k, v] : sec.fields) {
+            out += k;
+            out += ": ";
+            out += v;
+            out += "\n";
+        }
+    }
+    out += "\n";
+}
+
+// --format ndjson: one object per file, e.g.
+//   {"path":"a.jpg","size":123,"date":"2024:05:01 10:00:00",
+//    "date_key":"Exif.Photo.DateTimeOriginal","exif":[["Exif.Image.Make","Canon"]]}
+// Sections are [key, value] pairs since XMP/IPTC keys may repeat; "size",
+// "errors", "date" and the sections only appear when known/selected, and
+// spider's records carry "url" (and "path" only if the image was saved).
+inline void write_ndjson(std::string& out, const FileRecord& r) {
+    out.push_back('{');
+    bool first = true;
+    // `"name":`, after a comma unless it is the first field
+    auto field = [&](const char* name) {
+        if (!first) out.push_back(',');
+        first = false;
+        out.push_back('"');
+        out += name;
+        out += "\":";
+    };
+    if (!r.path.empty()) {
+        field("path");
+        json_escape(out, r.path);
+    }
+    if (!r.url.empty()) {
+        field("url");
+        json_escape(out, r.url);
+    }
+    if (r.has_size) {
+        field("size");
+        put_uint(out, r.size);
+    }
+    if (!r.errors.empty()) {
+        field("errors");
+        out.push_back('[');
+        for (size_t i = 0; i < r.errors.size(); ++i) {
+            if (i) out.push_back(',');
+            json_escape(out, r.errors[i]);
+        }
+        out.push_back(']');
+    }
+    if (r.meta && r.want_date) {
+        if (r.date_key.empty()) {
+            field("date");
+            out += "null";
+        } else {
+            field("date");
+            json_escape(out, r.date);
+            field("date_key");
+            json_escape(out, r.date_key);
+        }
+    }
+    for (int s = 0; r.meta && s < 3; ++s) {
+        const auto& sec = r.sections[s];
+        if (!sec.shown) continue;
+        field(section_names[s]);
+        out.push_back('[');
+        for (size_t i = 0; i < sec.fields.size(); ++i) {
+            if (i) out.push_back(',');
+            out.push_back('[');
+            json_escape(out, sec.fields[i].first);
+            out.push_back(',');
+            json_escape(out, sec.fields[i].second);
+            out.push_back(']');
+        }
+        out.push_back(']');
+    }
+    out += "}\n";
+}
+
+} // namespace meta
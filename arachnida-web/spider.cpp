@@ -1,392 +1,4260 @@
 #include <curl/curl.h>
+#ifdef SPIDER_WITH_META
+#include "scorpion_meta.hpp"
+#endif
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
-#include <regex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// The event-loop engine needs C++20 coroutines and epoll/timerfd.
+#if defined(__linux__) && defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define SPIDER_ASYNC 1
+#include <coroutine>
+#include <queue>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
 namespace fs = std::filesystem;
 
 /* ===================== Utils ===================== */
 
-static std::string to_lower(std::string s) {
-    std::transform(s.begin(), s.end(), s.begin(),
-                   [](unsigned char c){ return (char)std::tolower(c); });
-    return s;
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::tolower((unsigned char)a[i]) != std::tolower((unsigned char)b[i])) return false;
+    }
+    return true;
+}
+
+static bool istarts_with(std::string_view s, std::string_view pref) {
+    return s.size() >= pref.size() && iequals(s.substr(0, pref.size()), pref);
 }
 
-static bool starts_with(const std::string& s, const std::string& pref) {
-    return s.rfind(pref, 0) == 0;
+static bool iends_with(std::string_view s, std::string_view suf) {
+    return s.size() >= suf.size() && iequals(s.substr(s.size() - suf.size()), suf);
 }
 
-static std::string trim(std::string s) {
-    auto isws = [](unsigned char c){ return std::isspace(c); };
-    while (!s.empty() && isws((unsigned char)s.front())) s.erase(s.begin());
-    while (!s.empty() && isws((unsigned char)s.back())) s.pop_back();
+static std::string_view trim_view(std::string_view s) {
+    while (!s.empty() && std::isspace((unsigned char)s.front())) s.remove_prefix(1);
+    while (!s.empty() && std::isspace((unsigned char)s.back())) s.remove_suffix(1);
     return s;
 }
 
+// 64-bit URL fingerprint: FNV-1a with a splitmix64 finalizer. At a
+// million URLs the odds of any collision are around 1 in 10^7.
+static uint64_t url_fingerprint(std::string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27; h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+// LEB128 varints for the on-disk record formats (journal, frontier spill).
+static size_t put_varint(char* p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+static bool get_varint(std::string_view d, size_t& i, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; i < d.size() && shift < 64; shift += 7) {
+        unsigned char c = (unsigned char)d[i++];
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
 /* ===================== URL parsing / joining ===================== */
 
+// An http(s) URL parsed once into offsets over a single buffer:
+//
+//   buf = "https://example.com:8080/a/b/index.html"
+//          ^^^^^   ^^^^^^^^^^^^^^^^
+//          scheme  host            path (may be empty -> "/")
+//
+// The scheme is stored lowercase; the host is kept as written and must be
+// compared with iequals.
 struct UrlParts {
-    std::string scheme; // http or https
-    std::string host;   // example.com:8080
-    std::string path;   // /a/b/index.html  (may be empty -> "/")
+    std::string buf;
+    uint32_t scheme_len = 0;
+    uint32_t host_begin = 0;
+    uint32_t host_end = 0;
+
+    std::string_view scheme() const { return std::string_view(buf).substr(0, scheme_len); }
+    std::string_view host() const {
+        return std::string_view(buf).substr(host_begin, host_end - host_begin);
+    }
+    std::string_view path() const {
+        std::string_view p = std::string_view(buf).substr(host_end);
+        return p.empty() ? std::string_view("/") : p;
+    }
+    // "scheme://host", the prefix every joined URL starts with
+    std::string_view origin() const { return std::string_view(buf).substr(0, host_end); }
 };
 
-static std::optional<UrlParts> parse_url(const std::string& url) {
-    // Very small parser: scheme://host/path...
-    // Accept http(s) only.
-    static const std::regex re(R"(^\s*(https?)://([^/]+)(/.*)?\s*$)",
-                               std::regex::icase);
-    std::smatch m;
-    if (!std::regex_match(url, m, re)) return std::nullopt;
+static bool same_host(std::string_view host, const UrlParts& b) {
+    return iequals(host, b.host());
+}
+
+// Very small parser: scheme://host/path... Accept http(s) only.
+// split_url() checks an already trimmed URL in place and finds where its
+// scheme and host end; parse_url() takes the string by value so callers
+// can move a freshly joined URL in without another copy.
+static bool split_url(std::string_view v, size_t& scheme_len, size_t& host_end) {
+    if (istarts_with(v, "http://")) scheme_len = 4;
+    else if (istarts_with(v, "https://")) scheme_len = 5;
+    else return false;
+
+    host_end = v.find('/', scheme_len + 3);
+    if (host_end == std::string_view::npos) host_end = v.size();
+    return host_end != scheme_len + 3;
+}
+
+static std::optional<UrlParts> parse_url(std::string url) {
+    std::string_view v = trim_view(url);
+    size_t scheme_len, host_end;
+    if (!split_url(v, scheme_len, host_end)) return std::nullopt;
 
     UrlParts p;
-    p.scheme = to_lower(m[1].str());
-    p.host   = m[2].str();
-    p.path   = m[3].matched ? m[3].str() : "/";
-    if (p.path.empty()) p.path = "/";
+    if (v.size() != url.size()) {
+        url.erase(0, v.data() - url.data());
+        url.resize(v.size());
+    }
+    p.buf = std::move(url);
+    for (size_t i = 0; i < scheme_len; ++i) {
+        p.buf[i] = (char)std::tolower((unsigned char)p.buf[i]);
+    }
+    p.scheme_len = (uint32_t)scheme_len;
+    p.host_begin = (uint32_t)(scheme_len + 3);
+    p.host_end = (uint32_t)host_end;
     return p;
 }
 
-static std::string url_base_dir(const UrlParts& base) {
+static std::string_view url_base_dir(const UrlParts& base) {
     // Return base directory like /a/b/ from /a/b/index.html
-    std::string path = base.path;
-    if (path.empty()) return "/";
+    std::string_view path = base.path();
     // strip query/fragment if present (very minimal)
     auto qpos = path.find_first_of("?#");
-    if (qpos != std::string::npos) path = path.substr(0, qpos);
-
-    if (path.back() == '/') return path;
+    if (qpos != std::string_view::npos) path = path.substr(0, qpos);
 
     auto slash = path.find_last_of('/');
-    if (slash == std::string::npos) return "/";
+    if (slash == std::string_view::npos) return "/";
     return path.substr(0, slash + 1);
 }
 
-static std::string normalize_url(const std::string& url) {
-    // Minimal normalization: trim spaces.
-    return trim(url);
+// RFC 3986 remove_dot_segments, in place over s[0, n) where s[0] == '/'.
+// Returns the new length.
+static size_t remove_dot_segments(char* s, size_t n) {
+    size_t w = 0, r = 0;
+    while (r < n) {
+        size_t e = r + 1;
+        while (e < n && s[e] != '/') ++e;
+        const char* seg = s + r + 1;
+        size_t len = e - r - 1;
+
+        bool dot = len == 1 && seg[0] == '.';
+        bool dotdot = len == 2 && seg[0] == '.' && seg[1] == '.';
+        if (dotdot) {
+            // drop the last output segment, "/x" included
+            while (w > 0 && s[--w] != '/') {}
+        }
+        if (dot || dotdot) {
+            if (e == n) s[w++] = '/';   // "/a/b/.." -> "/a/"
+        } else {
+            std::memmove(s + w, s + r, e - r);
+            w += e - r;
+        }
+        r = e;
+    }
+    if (w == 0) s[w++] = '/';
+    return w;
 }
 
-static std::string join_url(const UrlParts& base, const std::string& href) {
-    std::string h = normalize_url(href);
-    if (h.empty()) return "";
+// Resolves `href` against `base` into `out` (left empty for anchors,
+// javascript: and mailto: links). Any string type with std::string's
+// interface works, so the crawler can join into its page arena.
+template <class Str>
+static void join_url_to(const UrlParts& base, std::string_view href, Str& out) {
+    out.clear();
+    std::string_view h = trim_view(href);
+    if (h.empty()) return;
 
     // ignore anchors / javascript / mailto
-    std::string hl = to_lower(h);
-    if (starts_with(hl, "javascript:") || starts_with(hl, "mailto:")) return "";
-    if (h[0] == '#') return "";
+    if (istarts_with(h, "javascript:") || istarts_with(h, "mailto:")) return;
+    if (h[0] == '#') return;
 
-    if (starts_with(hl, "http://") || starts_with(hl, "https://")) {
-        return h;
+    if (istarts_with(h, "http://") || istarts_with(h, "https://")) {
+        out.assign(h.data(), h.size());
+        return;
     }
 
     // scheme-relative: //cdn.site/img.png
-    if (starts_with(h, "//")) {
-        return base.scheme + ":" + h;
+    if (h.size() >= 2 && h[0] == '/' && h[1] == '/') {
+        out.reserve(base.scheme_len + 1 + h.size());
+        out.append(base.scheme()).append(":").append(h);
+        return;
     }
 
+    std::string_view origin = base.origin();
     // absolute path: /img/a.png
-    if (starts_with(h, "/")) {
-        return base.scheme + "://" + base.host + h;
+    if (h[0] == '/') {
+        out.reserve(origin.size() + h.size());
+        out.append(origin).append(h);
+        return;
     }
 
     // relative path: img/a.png or ../img/a.png
-    std::string dir = url_base_dir(base);
-    std::string combined = dir + h;
-
-    // normalize ./ and ../ (simple, filesystem-like on URL path)
-    std::vector<std::string> parts;
-    std::string tmp;
-    for (size_t i = 0; i < combined.size(); ++i) {
-        char c = combined[i];
-        if (c == '/') {
-            if (!tmp.empty()) {
-                parts.push_back(tmp);
-                tmp.clear();
+    std::string_view dir = url_base_dir(base);
+    out.reserve(origin.size() + dir.size() + h.size());
+    out.append(origin).append(dir).append(h);
+
+    // resolve ./ and ../ in the path only, leaving ?query#fragment alone
+    size_t path_end = out.find_first_of("?#", origin.size());
+    if (path_end == Str::npos) path_end = out.size();
+    size_t len = remove_dot_segments(&out[origin.size()], path_end - origin.size());
+    out.erase(origin.size() + len, path_end - origin.size() - len);
+}
+
+[[maybe_unused]] static std::string join_url(const UrlParts& base, std::string_view href) {
+    std::string out;
+    join_url_to(base, href, out);
+    return out;
+}
+
+/* ===================== HTML extraction ===================== */
+
+// Hand-written tag scanner: one pass over the page, no regex, no copies.
+// Every URL handed out is a std::string_view into the caller's buffer.
+
+static bool is_html_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+enum class HtmlRef { Image, Link };
+
+/* ---- Vectorized skip to the next tag ----
+   Most of a page is text and tags scan_html ignores, so the hot loop is
+   "find the next '<' that may open <img>, <source>, <link> or <a>": a '<'
+   followed by a/i/l/s in either case, or by a control/space byte (the
+   scanner allows "< img"). The kernels test 16 or 32 positions per step
+   and only return candidates; scan_html still checks the tag name.
+   A '<' in the last byte is always returned, it may be a cut-off tag. */
+
+// Reference version, also used for tails and on other CPUs.
+static size_t find_tag_open_scalar(const char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        const void* lt = std::memchr(p + i, '<', n - i);
+        if (!lt) return n;
+        i = (size_t)(static_cast<const char*>(lt) - p);
+        if (i + 1 == n) return i;
+        unsigned char c = (unsigned char)p[i + 1];
+        unsigned char f = c | 0x20;
+        if (f == 'a' || f == 'i' || f == 'l' || f == 's' || c <= 0x20) return i;
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2")))
+static size_t find_tag_open_sse2(const char* p, size_t n) {
+    const __m128i lt = _mm_set1_epi8('<'), fold = _mm_set1_epi8(0x20);
+    const __m128i a = _mm_set1_epi8('a'), i_ = _mm_set1_epi8('i'), l = _mm_set1_epi8('l'), s = _mm_set1_epi8('s');
+    size_t i = 0;
+    for (; i + 17 <= n; i += 16) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(cur, lt));
+        if (!m) continue;
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1));
+        __m128i f = _mm_or_si128(next, fold);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(f, a), _mm_cmpeq_epi8(f, i_)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(f, l), _mm_cmpeq_epi8(f, s)));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_max_epu8(next, fold), fold));   // next <= 0x20
+        m &= (unsigned)_mm_movemask_epi8(hit);
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + find_tag_open_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_tag_open_avx2(const char* p, size_t n) {
+    const __m256i lt = _mm256_set1_epi8('<'), fold = _mm256_set1_epi8(0x20);
+    const __m256i a = _mm256_set1_epi8('a'), i_ = _mm256_set1_epi8('i');
+    const __m256i l = _mm256_set1_epi8('l'), s = _mm256_set1_epi8('s');
+    size_t i = 0;
+    for (; i + 33 <= n; i += 32) {
+        __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cur, lt));
+        if (!m) continue;
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 1));
+        __m256i f = _mm256_or_si256(next, fold);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(f, a), _mm256_cmpeq_epi8(f, i_)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(f, l), _mm256_cmpeq_epi8(f, s)));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(_mm256_max_epu8(next, fold), fold));
+        m &= (unsigned)_mm256_movemask_epi8(hit);
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + find_tag_open_sse2(p + i, n - i);
+}
+
+#elif defined(__aarch64__)
+
+static size_t find_tag_open_neon(const char* p, size_t n) {
+    const uint8x16_t lt = vdupq_n_u8('<'), fold = vdupq_n_u8(0x20);
+    const uint8x16_t a = vdupq_n_u8('a'), i_ = vdupq_n_u8('i'), l = vdupq_n_u8('l'), s = vdupq_n_u8('s');
+    auto bits = [](uint8x16_t v) {   // 4 bits per lane: movemask substitute
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+    };
+    size_t i = 0;
+    for (; i + 17 <= n; i += 16) {
+        const uint8_t* q = reinterpret_cast<const uint8_t*>(p + i);
+        uint8x16_t is_lt = vceqq_u8(vld1q_u8(q), lt);
+        if (!bits(is_lt)) continue;
+        uint8x16_t next = vld1q_u8(q + 1);
+        uint8x16_t f = vorrq_u8(next, fold);
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(f, a), vceqq_u8(f, i_)), vorrq_u8(vceqq_u8(f, l), vceqq_u8(f, s)));
+        hit = vorrq_u8(hit, vcleq_u8(next, fold));
+        uint64_t m = bits(vandq_u8(is_lt, hit));
+        if (m) return i + (size_t)(__builtin_ctzll(m) >> 2);
+    }
+    return i + find_tag_open_scalar(p + i, n - i);
+}
+
+#endif
+
+using TagScanFn = size_t (*)(const char*, size_t);
+
+struct TagScanKernel {
+    const char* name;
+    TagScanFn fn;
+};
+
+// Kernels this CPU can run, widest first (the benchmark runs them all).
+static std::vector<TagScanKernel> tag_scan_kernels() {
+    std::vector<TagScanKernel> out;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) out.push_back({"avx2", find_tag_open_avx2});
+    if (__builtin_cpu_supports("sse2")) out.push_back({"sse2", find_tag_open_sse2});
+#elif defined(__aarch64__)
+    out.push_back({"neon", find_tag_open_neon});
+#endif
+    out.push_back({"scalar", find_tag_open_scalar});
+    return out;
+}
+
+static const TagScanKernel tag_scan = tag_scan_kernels().front();
+
+// Offset of the next candidate tag start at or after `i`, or npos.
+static size_t find_tag_open(std::string_view html, size_t i) {
+    if (i >= html.size()) return std::string_view::npos;
+    size_t k = i + tag_scan.fn(html.data() + i, html.size() - i);
+    return k < html.size() ? k : std::string_view::npos;
+}
+
+// Walks the attributes of one tag, starting right after its name.
+// Calls f(name, value) for each attribute and returns the offset just past
+// the closing '>', or npos if the tag is not terminated inside `html`.
+// Values may be "double", 'single' quoted or unquoted; quoted values may
+// contain '>'. A quote that never closes makes the tag unterminated,
+// unless `lenient`: then the value runs like an unquoted one.
+template <class F>
+static size_t scan_attrs(std::string_view html, size_t i, F&& f, bool lenient = false) {
+    const size_t n = html.size();
+    for (;;) {
+        while (i < n && (is_html_space(html[i]) || html[i] == '/')) ++i;
+        if (i >= n) return std::string_view::npos;
+        if (html[i] == '>') return i + 1;
+
+        size_t name_begin = i;
+        while (i < n && !is_html_space(html[i]) && html[i] != '=' && html[i] != '>' && html[i] != '/') ++i;
+        std::string_view name = html.substr(name_begin, i - name_begin);
+
+        while (i < n && is_html_space(html[i])) ++i;
+        if (i >= n) return std::string_view::npos;
+        if (html[i] != '=') {
+            f(name, std::string_view());
+            continue;
+        }
+        ++i;
+        while (i < n && is_html_space(html[i])) ++i;
+        if (i >= n) return std::string_view::npos;
+
+        std::string_view value;
+        bool quoted = false;
+        if (html[i] == '"' || html[i] == '\'') {
+            char q = html[i++];
+            size_t close = html.find(q, i);
+            if (close != std::string_view::npos) {
+                value = html.substr(i, close - i);
+                i = close + 1;
+                quoted = true;
+            } else if (!lenient) {
+                return std::string_view::npos;
+            }
+        }
+        if (!quoted) {
+            size_t value_begin = i;
+            while (i < n && !is_html_space(html[i]) && html[i] != '>') ++i;
+            value = html.substr(value_begin, i - value_begin);
+        }
+        f(name, value);
+    }
+}
+
+// Case-insensitive FNV-1a of a tag or attribute name. constexpr, so the
+// names scan_html looks for become compile-time case labels: one hash
+// and one switch per name instead of a chain of string compares.
+static constexpr uint32_t name_hash(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (char c : s) {
+        if (c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+        h = (h ^ (unsigned char)c) * 16777619u;
+    }
+    return h;
+}
+
+// URLs of a srcset list ("a.jpg 1x, b.jpg 480w, ..."): each candidate is
+// a run of non-space characters (trailing commas dropped) followed by
+// optional descriptors up to the next comma.
+template <class F>
+static void scan_srcset(std::string_view v, F&& emit) {
+    size_t i = 0;
+    const size_t n = v.size();
+    while (i < n) {
+        while (i < n && (is_html_space(v[i]) || v[i] == ',')) ++i;
+        size_t begin = i;
+        while (i < n && !is_html_space(v[i])) ++i;
+        std::string_view url = v.substr(begin, i - begin);
+        bool descriptors = true;
+        while (!url.empty() && url.back() == ',') {
+            url.remove_suffix(1);
+            descriptors = false;
+        }
+        if (!url.empty()) emit(url);
+        if (!descriptors) continue;
+        for (int depth = 0; i < n && (v[i] != ',' || depth > 0); ++i) {
+            if (v[i] == '(') ++depth;
+            else if (v[i] == ')' && depth > 0) --depth;
+        }
+    }
+}
+
+// Whether the space-separated token list `v` (a rel value) contains `tok`.
+static bool has_token(std::string_view v, std::string_view tok) {
+    size_t i = 0;
+    while (i < v.size()) {
+        while (i < v.size() && is_html_space(v[i])) ++i;
+        size_t begin = i;
+        while (i < v.size() && !is_html_space(v[i])) ++i;
+        if (i > begin && iequals(v.substr(begin, i - begin), tok)) return true;
+    }
+    return false;
+}
+
+// Single pass over `html` reporting, in document order:
+//   HtmlRef::Image  <img> and <source> src / srcset and their lazy-load
+//                   data-src / data-srcset, <link rel=preload as=image>
+//                   href / imagesrcset
+//   HtmlRef::Link   <a href>
+// Tag and attribute names match case-insensitively; empty values are
+// skipped and srcset lists are split into their URLs.
+// With `partial` (a chunk of a longer stream), returns the offset of a
+// trailing tag cut off by the end of the buffer so the caller can resume
+// there. Otherwise `html` is the whole page: a tag spoilt by an unclosed
+// quote ends at its next '>' and the scan goes on. Returns npos if
+// nothing is left over.
+template <class F>
+static size_t scan_html(std::string_view html, F&& emit, bool partial = false) {
+    enum class Tag { Img, Source, Link, A };
+    const size_t n = html.size();
+    size_t i = 0;
+    while ((i = find_tag_open(html, i)) != std::string_view::npos) {
+        size_t tag_begin = i++;
+        while (i < n && is_html_space(html[i])) ++i;
+
+        size_t name_begin = i;
+        while (i < n && std::isalnum((unsigned char)html[i])) ++i;
+        if (i >= n) return partial ? tag_begin : std::string_view::npos;
+        std::string_view name = html.substr(name_begin, i - name_begin);
+        if (!is_html_space(html[i]) && html[i] != '>' && html[i] != '/') continue;
+
+        Tag tag;
+        switch (name_hash(name)) {
+        case name_hash("img"):    tag = Tag::Img; break;
+        case name_hash("source"): tag = Tag::Source; break;
+        case name_hash("link"):   tag = Tag::Link; break;
+        case name_hash("a"):      tag = Tag::A; break;
+        default: continue;
+        }
+        // a hash hit on any other name is ruled out here
+        static constexpr std::string_view tag_names[] = {"img", "source", "link", "a"};
+        if (!iequals(name, tag_names[(int)tag])) continue;
+
+        // find the end first so a tag cut off mid-stream emits nothing yet
+        size_t end = scan_attrs(html, i, [](std::string_view, std::string_view) {});
+        bool lenient = false;
+        if (end == std::string_view::npos) {
+            if (partial) return tag_begin;
+            size_t gt = html.find('>', i);
+            if (gt == std::string_view::npos) return std::string_view::npos;
+            end = gt + 1;
+            lenient = true;
+        }
+
+        // <link> only counts as an image once rel and as are both known
+        bool preload = false, as_image = false;
+        std::string_view link_href, link_srcset;
+        scan_attrs(html.substr(0, end), i, [&](std::string_view attr, std::string_view value) {
+            value = trim_view(value);
+            if (value.empty()) return;
+            uint32_t h = name_hash(attr);
+            if (tag == Tag::A) {
+                if (h == name_hash("href") && iequals(attr, "href")) emit(HtmlRef::Link, value);
+                return;
+            }
+            if (tag == Tag::Link) {
+                switch (h) {
+                case name_hash("rel"):         preload = iequals(attr, "rel") && has_token(value, "preload"); break;
+                case name_hash("as"):          as_image = iequals(attr, "as") && iequals(value, "image"); break;
+                case name_hash("href"):        if (iequals(attr, "href")) link_href = value; break;
+                case name_hash("imagesrcset"): if (iequals(attr, "imagesrcset")) link_srcset = value; break;
+                }
+                return;
+            }
+            switch (h) {   // <img> and <source>
+            case name_hash("src"):
+            case name_hash("data-src"):
+                if (iequals(attr, "src") || iequals(attr, "data-src")) emit(HtmlRef::Image, value);
+                break;
+            case name_hash("srcset"):
+            case name_hash("data-srcset"):
+                if (iequals(attr, "srcset") || iequals(attr, "data-srcset")) {
+                    scan_srcset(value, [&](std::string_view u) { emit(HtmlRef::Image, u); });
+                }
+                break;
+            }
+        }, lenient);
+        if (tag == Tag::Link && preload && as_image) {
+            if (!link_href.empty()) emit(HtmlRef::Image, link_href);
+            scan_srcset(link_srcset, [&](std::string_view u) { emit(HtmlRef::Image, u); });
+        }
+        i = end;
+    }
+    return std::string_view::npos;
+}
+
+// Resumable front end to scan_html for pages that arrive in chunks.
+// Only an unfinished trailing tag is kept between calls, never the page.
+// Views passed to emit point into the chunk or the carry buffer and are
+// only valid for the duration of the call.
+struct HtmlStreamScanner {
+    static constexpr size_t kMaxCarry = 64 * 1024;  // give up on absurdly long tags
+    std::string carry;
+
+    template <class F>
+    void feed(std::string_view chunk, F&& emit) {
+        if (carry.empty()) {
+            size_t rest = scan_html(chunk, emit, true);
+            if (rest != std::string_view::npos) carry.assign(chunk.substr(rest));
+            return;
+        }
+        carry.append(chunk);
+        size_t rest = scan_html(carry, emit, true);
+        if (rest == std::string_view::npos) carry.clear();
+        else carry.erase(0, rest);
+        if (carry.size() > kMaxCarry) {
+            // most likely an unclosed quote, not a huge tag: scan what we
+            // have as a whole page would be, rather than dropping it
+            scan_html(carry, emit);
+            carry.clear();
+        }
+    }
+
+    // End of the page: what is still held is scanned as final.
+    template <class F>
+    void finish(F&& emit) {
+        if (!carry.empty()) scan_html(carry, emit);
+        carry.clear();
+    }
+};
+
+// Single-kind wrappers around the scanner; the crawler itself uses
+// scan_html directly so each page is only walked once.
+
+// Values of every `attrName` attribute inside a single tag such as
+// `<img alt="x" src="a.png">` (or a bare attribute list).
+[[maybe_unused]] static std::vector<std::string_view> extract_attr_urls(std::string_view tag, std::string_view attrName) {
+    std::vector<std::string_view> out;
+    size_t i = 0;
+    if (!tag.empty() && tag[0] == '<') {
+        i = 1;
+        while (i < tag.size() && is_html_space(tag[i])) ++i;
+        while (i < tag.size() && std::isalnum((unsigned char)tag[i])) ++i;
+    }
+    scan_attrs(tag, i, [&](std::string_view name, std::string_view value) {
+        if (!iequals(name, attrName)) return;
+        value = trim_view(value);
+        if (!value.empty()) out.push_back(value);
+    });
+    return out;
+}
+
+[[maybe_unused]] static std::vector<std::string_view> extract_img_srcs(std::string_view html) {
+    std::vector<std::string_view> out;
+    scan_html(html, [&](HtmlRef kind, std::string_view url) {
+        if (kind == HtmlRef::Image) out.push_back(url);
+    });
+    return out;
+}
+
+[[maybe_unused]] static std::vector<std::string_view> extract_a_hrefs(std::string_view html) {
+    std::vector<std::string_view> out;
+    scan_html(html, [&](HtmlRef kind, std::string_view url) {
+        if (kind == HtmlRef::Link) out.push_back(url);
+    });
+    return out;
+}
+
+/* ===================== Image filters ===================== */
+
+static bool is_image_url(std::string_view url) {
+    std::string_view u = url;
+    // strip query/fragment for extension check
+    auto cut = u.find_first_of("?#");
+    if (cut != std::string_view::npos) u = u.substr(0, cut);
+
+    static constexpr std::string_view exts[] = {
+        ".jpg", ".jpeg", ".png", ".gif", ".bmp", ".webp"
+    };
+
+    for (auto e : exts) {
+        if (iends_with(u, e)) return true;
+    }
+    return false;
+}
+
+// Content-Type of an image response. A missing header or a generic
+// binary type is left to the magic check.
+static bool image_content_type_ok(std::string_view ct) {
+    ct = trim_view(ct.substr(0, std::min(ct.find(';'), ct.size())));
+    return ct.empty() || istarts_with(ct, "image/") ||
+           iequals(ct, "application/octet-stream") || iequals(ct, "binary/octet-stream");
+}
+
+enum class Sniff { Image, NotImage, NeedMore };
+
+// Magic numbers of the formats is_image_url accepts; '?' is any byte.
+static Sniff sniff_image(std::string_view head) {
+    static constexpr std::string_view magics[] = {
+        std::string_view("\xFF\xD8\xFF", 3),           // JPEG
+        std::string_view("\x89PNG\r\n\x1A\n", 8),       // PNG
+        "GIF87a", "GIF89a",
+        "BM",                                         // BMP
+        "RIFF????WEBP"                                // WebP (chunk size in between)
+    };
+    bool more = false;
+    for (auto m : magics) {
+        size_t n = std::min(m.size(), head.size());
+        size_t k = 0;
+        while (k < n && (m[k] == '?' || head[k] == m[k])) ++k;
+        if (k < n) continue;
+        if (n == m.size()) return Sniff::Image;
+        more = true;
+    }
+    return more ? Sniff::NeedMore : Sniff::NotImage;
+}
+
+enum class Prefix { Complete, NeedMore, Unknown };
+
+// Whether the first bytes of an image already hold all of its metadata
+// (--meta-range). JPEG: every segment before the first scan (SOS); PNG:
+// every chunk before the first IDAT. On Complete `need` is how much to
+// keep, on NeedMore the least total length that gets the walk further.
+// Other formats are Unknown: only the whole body will do.
+static Prefix meta_prefix(std::string_view b, size_t& need) {
+    auto u8 = [&](size_t i) { return (unsigned char)b[i]; };
+    if (b.size() < 8) {
+        need = 8;
+        return b.empty() || u8(0) == 0xFF || u8(0) == 0x89 ? Prefix::NeedMore : Prefix::Unknown;
+    }
+    if (u8(0) == 0xFF && u8(1) == 0xD8) {
+        size_t i = 2;
+        for (;;) {
+            if (i + 4 > b.size()) break;
+            if (u8(i) != 0xFF) return Prefix::Unknown;   // not a marker: let Exiv2 judge the whole file
+            unsigned m = u8(i + 1);
+            if (m == 0xFF) {   // fill byte
+                ++i;
+                continue;
+            }
+            if (m == 0xDA || m == 0xD9) {   // SOS / EOI
+                need = i;
+                return Prefix::Complete;
+            }
+            if (m == 0x01 || (m >= 0xD0 && m <= 0xD7)) {
+                i += 2;
+                continue;
+            }
+            i += 2 + ((size_t)u8(i + 2) << 8 | u8(i + 3));
+        }
+        need = i + 4;
+        return Prefix::NeedMore;
+    }
+    if (b.compare(0, 8, std::string_view("\x89PNG\r\n\x1A\n", 8)) == 0) {
+        size_t i = 8;
+        while (i + 8 <= b.size()) {
+            std::string_view type = b.substr(i + 4, 4);
+            if (type == "IDAT" || type == "IEND") {
+                need = i;
+                return Prefix::Complete;
+            }
+            size_t len = (size_t)u8(i) << 24 | (size_t)u8(i + 1) << 16 | (size_t)u8(i + 2) << 8 | u8(i + 3);
+            i += 12 + len;
+        }
+        need = i + 8;
+        return Prefix::NeedMore;
+    }
+    return Prefix::Unknown;
+}
+
+// Closes a Complete prefix so a parser sees a well-formed (image-less) file.
+static void end_meta_prefix(std::string& b, size_t keep) {
+    bool png = b.size() > 1 && (unsigned char)b[0] == 0x89;
+    b.resize(keep);
+    if (png) b.append("\0\0\0\0IEND\xAE\x42\x60\x82", 12);
+    else b.append("\xFF\xD9", 2);   // EOI
+}
+
+static std::string filename_from_url(std::string_view url) {
+    std::string_view u = url;
+    auto cut = u.find_first_of("?#");
+    if (cut != std::string_view::npos) u = u.substr(0, cut);
+
+    auto slash = u.find_last_of('/');
+    if (slash == std::string_view::npos || slash + 1 >= u.size()) {
+        // fallback
+        return "image.bin";
+    }
+    std::string name(u.substr(slash + 1));
+    if (name.empty()) name = "image.bin";
+
+    // avoid weird characters in filenames
+    for (char& c : name) {
+        if (!(std::isalnum((unsigned char)c) || c == '.' || c == '_' || c == '-' )) {
+            c = '_';
+        }
+    }
+    return name;
+}
+
+/* ===================== Logging ===================== */
+
+enum class LogLevel { Debug, Info, Warn, Error };
+
+enum class LogEvent { Message, Page, Image, ImageFailed, PageFailed, Disallowed };
+
+// One log line. Workers only fill this in; formatting and the write to
+// stderr happen on the logger's own thread.
+struct LogRecord {
+    LogLevel level = LogLevel::Info;
+    LogEvent event = LogEvent::Message;
+    int64_t ts_us = 0;       // wall clock
+    std::string url;
+    std::string detail;      // message text, depth, output path or failure reason
+    std::string note;        // image outcome: "not modified", "duplicate"
+};
+
+// Bounded multi-producer ring after D. Vyukov: every slot carries a
+// sequence number saying whose turn it is, so a push is one CAS on the
+// tail and a release store, no lock.
+struct LogRing {
+    struct Slot {
+        std::atomic<size_t> seq{0};
+        LogRecord rec;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};   // producers
+    alignas(64) std::atomic<size_t> head{0};   // consumer
+
+    explicit LogRing(size_t capacity_pow2)
+        : slots(new Slot[capacity_pow2]), mask(capacity_pow2 - 1) {
+        for (size_t i = 0; i < capacity_pow2; ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Leaves `r` untouched if the ring is full.
+    bool try_push(LogRecord& r) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots[pos & mask];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.rec = std::move(r);
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(LogRecord& out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots[pos & mask];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            auto diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(s.rec);
+                    s.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+static void json_escape(std::string& out, std::string_view v) {
+    for (char c : v) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char u[8];
+                std::snprintf(u, sizeof(u), "\\u%04x", (unsigned)c);
+                out += u;
             } else {
-                // keep empty segments implicit
+                out += c;
+            }
+        }
+    }
+}
+
+// Workers hand records to a lock-free ring and a background thread
+// formats them and writes them to stderr in large chunks, so logging
+// neither serialises the crawl nor costs a syscall per line. Until
+// start() (and after stop()) records are written synchronously.
+struct AsyncLogger {
+    static constexpr size_t kCapacity = 8192;
+    static constexpr size_t kFlushBytes = 64u << 10;
+
+    LogLevel min_level = LogLevel::Info;
+    bool json = false;   // NDJSON records instead of text lines
+
+    void start() {
+        ring = std::make_unique<LogRing>(kCapacity);
+        stopping = false;
+        running = true;
+        thread = std::thread([this] { loop(); });
+    }
+
+    // Drains everything queued so far, then returns to synchronous writes.
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            // new pushes write synchronously from here on
+            std::lock_guard<std::mutex> lock(mu);
+            running.store(false);
+        }
+        // ones that saw `running` before the store are still headed for
+        // the ring; the writer is still draining it, so they get through
+        while (pushers.load() != 0) std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    ~AsyncLogger() { stop(); }
+
+    void push(LogRecord r) {
+        if (r.level < min_level) return;
+        r.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::system_clock::now().time_since_epoch()).count();
+        // seq_cst against stop(): it either sees this push or we see it stopping
+        pushers.fetch_add(1);
+        if (!running.load()) {
+            pushers.fetch_sub(1);
+            std::string line;
+            format(r, line);
+            std::lock_guard<std::mutex> lock(sync_mu);
+            std::fwrite(line.data(), 1, line.size(), stderr);
+            return;
+        }
+        // full ring: the crawl waits for the writer instead of dropping lines
+        while (!ring->try_push(r)) {
+            wake();
+            std::this_thread::yield();
+        }
+        if (sleeping.load()) wake();
+        pushers.fetch_sub(1, std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<LogRing> ring;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<int> pushers{0};   // push() calls between the `running` check and the ring
+    std::atomic<bool> sleeping{false};
+    std::mutex mu;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::mutex sync_mu;
+    std::string out;
+
+    void wake() {
+        if (!sleeping.exchange(false)) return;
+        std::lock_guard<std::mutex> lock(mu);
+        cv.notify_one();
+    }
+
+    void drain() {
+        LogRecord r;
+        while (ring->try_pop(r)) {
+            format(r, out);
+            if (out.size() >= kFlushBytes) write_out();
+        }
+        write_out();
+    }
+
+    void write_out() {
+        if (out.empty()) return;
+        std::fwrite(out.data(), 1, out.size(), stderr);
+        out.clear();
+    }
+
+    void loop() {
+        for (;;) {
+            drain();
+            std::unique_lock<std::mutex> lock(mu);
+            if (stopping) break;
+            sleeping.store(true);
+            LogRecord probe;
+            if (ring->try_pop(probe)) {
+                sleeping.store(false);
+                lock.unlock();
+                format(probe, out);
+                continue;
+            }
+            // a push racing the probe above may not wake us;
+            // the timeout bounds how late its line comes out
+            cv.wait_for(lock, std::chrono::milliseconds(10), [this] { return stopping || !sleeping; });
+            sleeping.store(false);
+        }
+        drain();
+    }
+
+    void format(const LogRecord& r, std::string& o) const {
+        if (json) return format_json(r, o);
+        switch (r.event) {
+        case LogEvent::Message:
+            o += r.detail;
+            break;
+        case LogEvent::Page:
+            o += "[PAGE] " + r.url + " (depth_left=" + r.detail + ")";
+            break;
+        case LogEvent::Image:
+            o += "  [IMG] " + r.url + " -> " + r.detail;
+            if (!r.note.empty()) o += " (" + r.note + ")";
+            break;
+        case LogEvent::ImageFailed:
+            o += "  !! failed img: " + r.url;
+            if (!r.detail.empty()) o += " (" + r.detail + ")";
+            break;
+        case LogEvent::PageFailed:
+            o += "  !! failed to fetch: " + r.url;
+            break;
+        case LogEvent::Disallowed:
+            o += "  -- robots.txt disallows: " + r.url;
+            break;
+        }
+        o += '\n';
+    }
+
+    static void format_json(const LogRecord& r, std::string& o) {
+        static constexpr const char* levels[] = {"debug", "info", "warn", "error"};
+        static constexpr const char* events[] = {
+            "message", "page", "image", "image_failed", "page_failed", "disallowed"
+        };
+        o += "{\"ts_us\":" + std::to_string(r.ts_us);
+        o += ",\"level\":\"";
+        o += levels[(int)r.level];
+        o += "\",\"event\":\"";
+        o += events[(int)r.event];
+        o += '"';
+        if (!r.url.empty()) {
+            o += ",\"url\":\"";
+            json_escape(o, r.url);
+            o += '"';
+        }
+        if (r.event == LogEvent::Page) {
+            o += ",\"depth_left\":" + r.detail;
+        } else if (!r.detail.empty()) {
+            o += r.event == LogEvent::Message ? ",\"msg\":\"" : r.event == LogEvent::Image ? ",\"path\":\"" : ",\"reason\":\"";
+            json_escape(o, r.detail);
+            o += '"';
+        }
+        if (!r.note.empty()) {
+            o += ",\"note\":\"";
+            json_escape(o, r.note);
+            o += '"';
+        }
+        o += "}\n";
+    }
+};
+
+static AsyncLogger logger;
+
+static void log_event(LogLevel level, LogEvent event, std::string url,
+                      std::string detail = {}, std::string note = {}) {
+    LogRecord r;
+    r.level = level;
+    r.event = event;
+    r.url = std::move(url);
+    r.detail = std::move(detail);
+    r.note = std::move(note);
+    logger.push(std::move(r));
+}
+
+static void log_message(std::string text, LogLevel level = LogLevel::Info) {
+    log_event(level, LogEvent::Message, {}, std::move(text));
+}
+
+/* ===================== Telemetry ===================== */
+
+using StatClock = std::chrono::steady_clock;
+
+static uint64_t elapsed_ns(StatClock::time_point since) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(StatClock::now() - since).count();
+}
+
+// Adds the lifetime of the scope to a nanosecond accumulator.
+struct ScopedTimer {
+    uint64_t& acc_ns;
+    StatClock::time_point start = StatClock::now();
+    explicit ScopedTimer(uint64_t& acc) : acc_ns(acc) {}
+    ~ScopedTimer() { acc_ns += elapsed_ns(start); }
+};
+
+// Latency histogram in power-of-two microsecond buckets: bucket i holds
+// samples in [2^(i-1), 2^i) us. Recording is a few relaxed atomic adds,
+// so all workers share one instance without a lock.
+struct Histogram {
+    static constexpr int kBuckets = 40;   // last bucket: 2^38 us and up
+
+    std::atomic<uint64_t> buckets[kBuckets] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_us{0};
+    std::atomic<uint64_t> max_us{0};
+
+    void record(uint64_t us) {
+        int b = us == 0 ? 0 : std::min(kBuckets - 1, 64 - __builtin_clzll(us));
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum_us.fetch_add(us, std::memory_order_relaxed);
+        uint64_t m = max_us.load(std::memory_order_relaxed);
+        while (us > m && !max_us.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+    }
+
+    // Upper edge of the bucket holding the q-quantile (0 if empty).
+    uint64_t quantile(double q) const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        if (n == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (double)(n - 1)) + 1, seen = 0;
+        for (int b = 0; b < kBuckets; ++b) {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (seen >= rank) return b == 0 ? 0 : 1ull << b;
+        }
+        return max_us.load(std::memory_order_relaxed);
+    }
+
+    void write_json(std::ostream& os) const {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        os << "{\"count\":" << n
+           << ",\"mean_us\":" << (n ? sum_us.load(std::memory_order_relaxed) / n : 0)
+           << ",\"p50_us\":" << quantile(0.50)
+           << ",\"p90_us\":" << quantile(0.90)
+           << ",\"p99_us\":" << quantile(0.99)
+           << ",\"max_us\":" << max_us.load(std::memory_order_relaxed)
+           << ",\"buckets\":[";
+        // [upper edge in us, samples] for each non-empty bucket
+        bool first = true;
+        for (int b = 0; b < kBuckets; ++b) {
+            uint64_t c = buckets[b].load(std::memory_order_relaxed);
+            if (!c) continue;
+            os << (first ? "" : ",") << "[" << (b == 0 ? 1 : 1ull << b) << "," << c << "]";
+            first = false;
+        }
+        os << "]}";
+    }
+};
+
+// Crawl-wide counters and per-phase latencies. The curl phases are split
+// out of curl's cumulative timers; extract covers HTML scanning (with the
+// link/image handling it triggers) and write covers output file I/O.
+struct Telemetry {
+    Histogram dns, connect, tls, ttfb, transfer, total;
+    Histogram extract, write;
+    std::atomic<uint64_t> pages{0}, pages_failed{0}, images{0}, images_failed{0};
+    std::atomic<uint64_t> page_bytes{0}, image_bytes{0};
+    StatClock::time_point start = StatClock::now();
+
+    void record_transfer(CURL* curl, bool image) {
+        curl_off_t nl = 0, conn = 0, app = 0, pre = 0, st = 0, tot = 0, bytes = 0;
+        long new_conns = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &nl);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &conn);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pre);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &st);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &tot);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_conns);
+
+        // a reused connection had no lookup, connect or handshake
+        if (new_conns > 0) {
+            dns.record((uint64_t)nl);
+            connect.record((uint64_t)std::max<curl_off_t>(0, conn - nl));
+            if (app > 0) tls.record((uint64_t)std::max<curl_off_t>(0, app - conn));
+        }
+        if (st > 0) {
+            ttfb.record((uint64_t)std::max<curl_off_t>(0, st - pre));
+            transfer.record((uint64_t)std::max<curl_off_t>(0, tot - st));
+        }
+        total.record((uint64_t)tot);
+        (image ? image_bytes : page_bytes).fetch_add((uint64_t)bytes, std::memory_order_relaxed);
+    }
+
+    double seconds() const { return (double)elapsed_ns(start) / 1e9; }
+
+    void write_json(std::ostream& os) const {
+        double secs = std::max(seconds(), 1e-9);
+        auto rel = [](const std::atomic<uint64_t>& a) { return a.load(std::memory_order_relaxed); };
+        os << "{\"elapsed_s\":" << secs
+           << ",\"pages\":" << rel(pages) << ",\"pages_failed\":" << rel(pages_failed)
+           << ",\"images\":" << rel(images) << ",\"images_failed\":" << rel(images_failed)
+           << ",\"page_bytes\":" << rel(page_bytes) << ",\"image_bytes\":" << rel(image_bytes)
+           << ",\"pages_per_s\":" << (double)rel(pages) / secs
+           << ",\"images_per_s\":" << (double)rel(images) / secs
+           << ",\"bytes_per_s\":" << (double)(rel(page_bytes) + rel(image_bytes)) / secs
+           << ",\"latency\":{";
+        const std::pair<const char*, const Histogram*> hs[] = {
+            {"dns", &dns}, {"connect", &connect}, {"tls", &tls}, {"ttfb", &ttfb},
+            {"transfer", &transfer}, {"total", &total}, {"extract", &extract}, {"write", &write},
+        };
+        for (size_t i = 0; i < std::size(hs); ++i) {
+            os << (i ? "," : "") << "\"" << hs[i].first << "\":";
+            hs[i].second->write_json(os);
+        }
+        os << "}}\n";
+    }
+};
+
+// Prints rates over each interval (--stats-interval) until stopped.
+struct StatsReporter {
+    const Telemetry* stats = nullptr;
+    std::thread thread;
+    std::mutex mu;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void start(const Telemetry& t, double interval_s) {
+        stats = &t;
+        stopping = false;
+        thread = std::thread([this, interval_s] { loop(interval_s); });
+    }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    ~StatsReporter() { stop(); }
+
+private:
+    void loop(double interval_s) {
+        auto period = std::chrono::duration_cast<StatClock::duration>(std::chrono::duration<double>(interval_s));
+        uint64_t last_pages = 0, last_images = 0, last_bytes = 0;
+        auto last = StatClock::now();
+        std::unique_lock<std::mutex> lock(mu);
+        while (!cv.wait_for(lock, period, [this] { return stopping; })) {
+            uint64_t p = stats->pages.load(std::memory_order_relaxed);
+            uint64_t i = stats->images.load(std::memory_order_relaxed);
+            uint64_t b = stats->page_bytes.load(std::memory_order_relaxed) +
+                         stats->image_bytes.load(std::memory_order_relaxed);
+            double dt = std::max((double)elapsed_ns(last) / 1e9, 1e-9);
+            last = StatClock::now();
+
+            char line[160];
+            std::snprintf(line, sizeof(line),
+                          "[STATS] %.1f pages/s, %.1f images/s, %.2f MB/s (%llu pages, %llu images)",
+                          (double)(p - last_pages) / dt, (double)(i - last_images) / dt,
+                          (double)(b - last_bytes) / dt / 1e6, (unsigned long long)p, (unsigned long long)i);
+            log_message(line);
+            last_pages = p;
+            last_images = i;
+            last_bytes = b;
+        }
+    }
+};
+
+/* ===================== Connection reuse ===================== */
+
+// Recycles easy handles and lets every transfer share the DNS cache and
+// TLS sessions; the idle list and both shared caches are guarded by their
+// own mutex, so the pool can be used from several threads. Connections
+// are not shared: libcurl does not support one connection cache across
+// concurrent threads. Each thread's multi handle keeps its own (warm
+// connections and HTTP/2 streams are reused within it). A blocking
+// transfer uses its easy handle's cache, which goes back to the pool
+// with the handle.
+static void curl_share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userp);
+static void curl_share_unlock(CURL*, curl_lock_data data, void* userp);
+
+struct CurlPool {
+    CURLSH* share = nullptr;
+    std::mutex idle_mutex;
+    std::vector<CURL*> idle;
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+    CurlPool() : share(curl_share_init()) {
+        if (!share) return;
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, curl_share_lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    ~CurlPool() {
+        // handles must go before the share they are attached to
+        for (CURL* h : idle) curl_easy_cleanup(h);
+        if (share) curl_share_cleanup(share);
+    }
+    CurlPool(const CurlPool&) = delete;
+    CurlPool& operator=(const CurlPool&) = delete;
+
+    CURL* acquire() {
+        CURL* h = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            if (!idle.empty()) {
+                h = idle.back();
+                idle.pop_back();
+            }
+        }
+        if (h) curl_easy_reset(h);
+        else h = curl_easy_init();
+        if (!h) return nullptr;
+        if (share) curl_easy_setopt(h, CURLOPT_SHARE, share);
+        curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        return h;
+    }
+
+    void release(CURL* h) {
+        if (!h) return;
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle.push_back(h);
+    }
+};
+
+static void curl_share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+    static_cast<CurlPool*>(userp)->share_locks[data].lock();
+}
+
+static void curl_share_unlock(CURL*, curl_lock_data data, void* userp) {
+    static_cast<CurlPool*>(userp)->share_locks[data].unlock();
+}
+
+/* ===================== HTTP cache ===================== */
+
+// Validators from a response, collected by the header callback. Headers of
+// every hop arrive here (redirects, 100-continue); each status line starts
+// the record over so only the final response is kept.
+struct ResponseMeta {
+    std::string etag;
+    std::string last_modified;
+    long long length = -1;
+    long long range_total = -1;   // "Content-Range: bytes a-b/total"
+};
+
+static size_t on_header(char* buf, size_t size, size_t nitems, void* userp) {
+    size_t total = size * nitems;
+    auto* m = static_cast<ResponseMeta*>(userp);
+    std::string_view line(buf, total);
+    if (istarts_with(line, "HTTP/")) {
+        *m = ResponseMeta();
+        return total;
+    }
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) return total;
+    std::string_view name = trim_view(line.substr(0, colon));
+    std::string_view value = trim_view(line.substr(colon + 1));
+    if (iequals(name, "etag")) m->etag = std::string(value);
+    else if (iequals(name, "last-modified")) m->last_modified = std::string(value);
+    else if (iequals(name, "content-length")) m->length = std::atoll(std::string(value).c_str());
+    else if (iequals(name, "content-range")) {
+        auto slash = value.rfind('/');
+        if (slash != std::string_view::npos && slash + 1 < value.size() && value[slash + 1] != '*') {
+            m->range_total = std::atoll(std::string(value.substr(slash + 1)).c_str());
+        }
+    }
+    return total;
+}
+
+// Per-URL validators kept between runs (--cache DIR) so repeat crawls can
+// send conditional GETs. DIR/index.tsv holds "url etag last-modified
+// length" lines; page bodies are kept under DIR/pages so a 304 page can
+// still be parsed for links. Images are validated against the file
+// already in the output directory.
+struct HttpCache {
+    struct Entry {
+        std::string etag;
+        std::string last_modified;
+        long long length = -1;
+    };
+
+    fs::path dir;
+    std::mutex mu;
+    std::unordered_map<std::string, Entry> entries;
+    bool dirty = false;
+    std::atomic<uint64_t> tmp_seq{0};   // unique temp names for concurrent page writes
+
+    bool load(const fs::path& d) {
+        dir = d;
+        std::error_code ec;
+        fs::create_directories(dir / "pages", ec);
+        if (ec) return false;
+
+        std::ifstream in(dir / "index.tsv");
+        std::string line;
+        while (std::getline(in, line)) {
+            std::string_view v(line);
+            std::string_view f[4];
+            for (int i = 0; i < 3; ++i) {
+                auto tab = v.find('\t');
+                if (tab == std::string_view::npos) { v = {}; break; }
+                f[i] = v.substr(0, tab);
+                v.remove_prefix(tab + 1);
+            }
+            f[3] = v;
+            if (f[0].empty()) continue;
+            Entry e;
+            e.etag = std::string(f[1]);
+            e.last_modified = std::string(f[2]);
+            e.length = f[3].empty() ? -1 : std::atoll(std::string(f[3]).c_str());
+            entries[std::string(f[0])] = std::move(e);
+        }
+        return true;
+    }
+
+    // Rewrites the index (temp file + rename) if anything changed.
+    void save() {
+        std::lock_guard<std::mutex> lock(mu);
+        if (!dirty) return;
+        fs::path tmp = dir / "index.tsv.tmp";
+        std::error_code ec;
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            for (const auto& kv : entries) {
+                out << kv.first << '\t' << kv.second.etag << '\t' << kv.second.last_modified << '\t';
+                if (kv.second.length >= 0) out << kv.second.length;
+                out << '\n';
+            }
+            // a short write may only show up when close() flushes
+            out.close();
+            if (!out) {
+                fs::remove(tmp, ec);
+                return;
+            }
+        }
+        fs::rename(tmp, dir / "index.tsv", ec);
+        if (ec) fs::remove(tmp, ec);
+        else dirty = false;
+    }
+
+    std::optional<Entry> lookup(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = entries.find(url);
+        if (it == entries.end()) return std::nullopt;
+        return it->second;
+    }
+
+    void store(const std::string& url, const ResponseMeta& m) {
+        if (m.etag.empty() && m.last_modified.empty()) return;
+        // the index is tab/line separated
+        auto clean = [](std::string_view v) { return v.find_first_of("\t\r\n") == std::string_view::npos; };
+        if (!clean(url) || !clean(m.etag) || !clean(m.last_modified)) return;
+        std::lock_guard<std::mutex> lock(mu);
+        entries[url] = Entry{m.etag, m.last_modified, m.length};
+        dirty = true;
+    }
+
+    // Replaces the kept body of `url` (temp file + rename), so a failed
+    // write leaves the previous body, never a truncated one. Call store()
+    // only once this has succeeded.
+    bool write_page(std::string_view url, std::string_view body) {
+        fs::path path = page_path(url);
+        fs::path tmp = path;
+        tmp += ".tmp-" + std::to_string(tmp_seq++);
+        std::error_code ec;
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(body.data(), (std::streamsize)body.size());
+            out.close();
+            if (!out) {
+                fs::remove(tmp, ec);
+                return false;
+            }
+        }
+        fs::rename(tmp, path, ec);
+        if (!ec) return true;
+        fs::remove(tmp, ec);
+        return false;
+    }
+
+    fs::path page_path(std::string_view url) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.html", (unsigned long long)url_fingerprint(url));
+        return dir / "pages" / name;
+    }
+};
+
+static curl_slist* conditional_headers(const HttpCache::Entry& e) {
+    curl_slist* h = nullptr;
+    if (!e.etag.empty()) h = curl_slist_append(h, ("If-None-Match: " + e.etag).c_str());
+    if (!e.last_modified.empty()) h = curl_slist_append(h, ("If-Modified-Since: " + e.last_modified).c_str());
+    return h;
+}
+
+/* ===================== File output ===================== */
+
+// Write side of one output file. curl hands over a few KB per callback;
+// those are gathered in one aligned buffer and written in large blocks,
+// with the file preallocated when Content-Length is known. With `direct`
+// the blocks bypass the page cache (O_DIRECT); the unaligned tail goes
+// through a normal write after the flag is dropped.
+struct FileSink {
+    static constexpr size_t kAlign = 4096;
+    static constexpr size_t kMaxBuffer = 256u << 10;
+
+    int fd = -1;
+    bool direct = false;
+    char* buf = nullptr;
+    size_t cap = 0;
+    size_t used = 0;
+    long long written = 0;
+    long long reserved = 0;
+    bool failed = false;
+
+    FileSink() = default;
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+    ~FileSink() {
+        if (fd >= 0) ::close(fd);
+        std::free(buf);
+    }
+
+    bool is_open() const { return fd >= 0; }
+
+    // `expected` is the body length if known, -1 otherwise.
+    bool open(const fs::path& path, long long expected, bool want_direct) {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef O_DIRECT
+        if (want_direct) {
+            fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct = fd >= 0;
+        }
+#else
+        (void)want_direct;
+#endif
+        if (fd < 0) fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0 && errno == ENOENT && path.has_parent_path()) {
+            // first file in a directory that does not exist (any more)
+            std::error_code ec;
+            fs::create_directories(path.parent_path(), ec);
+            fd = ::open(path.c_str(), flags, 0644);
+        }
+        if (fd < 0) return false;
+
+        if (expected > 0 && ::posix_fallocate(fd, 0, (off_t)expected) == 0) reserved = expected;
+
+        // small bodies get a buffer that fits them, so they cost one write
+        size_t want = expected > 0 ? (size_t)std::min<long long>(expected, kMaxBuffer) : kMaxBuffer;
+        cap = (want + kAlign - 1) / kAlign * kAlign;
+        void* p = nullptr;
+        if (::posix_memalign(&p, kAlign, cap) != 0) {
+            close();
+            return false;
+        }
+        buf = static_cast<char*>(p);
+        used = 0;
+        written = 0;
+        failed = false;
+        return true;
+    }
+
+    bool write(const char* p, size_t n) {
+        while (n > 0 && !failed) {
+            size_t take = std::min(n, cap - used);
+            std::memcpy(buf + used, p, take);
+            used += take;
+            p += take;
+            n -= take;
+            if (used == cap) flush_block(cap);
+        }
+        return !failed;
+    }
+
+    // Flushes what is left and closes. Returns false if any write failed.
+    bool close() {
+        if (fd < 0) return false;
+        if (!failed && used > 0) {
+#ifdef O_DIRECT
+            if (direct && used % kAlign != 0) {
+                int fl = ::fcntl(fd, F_GETFL);
+                if (fl < 0 || ::fcntl(fd, F_SETFL, fl & ~O_DIRECT) < 0) failed = true;
+            }
+#endif
+            if (!failed) flush_block(used);
+        }
+        // preallocated for more than arrived: trim to what we have
+        if (!failed && reserved > written && ::ftruncate(fd, (off_t)written) != 0) failed = true;
+        if (::close(fd) != 0) failed = true;
+        fd = -1;
+        std::free(buf);
+        buf = nullptr;
+        return !failed;
+    }
+
+private:
+    void flush_block(size_t n) {
+        size_t off = 0;
+        while (off < n) {
+            ssize_t w = ::write(fd, buf + off, n - off);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                return;
+            }
+            off += (size_t)w;
+        }
+        written += (long long)n;
+        used = 0;
+    }
+};
+
+/* ===================== Content-addressed store ===================== */
+
+// Streaming XXH64 (little-endian hosts).
+struct Xxh64 {
+    static constexpr uint64_t P1 = 11400714785074694791ull;
+    static constexpr uint64_t P2 = 14029467366897019727ull;
+    static constexpr uint64_t P3 = 1609587929392839161ull;
+    static constexpr uint64_t P4 = 9650029242287828579ull;
+    static constexpr uint64_t P5 = 2870177450012600261ull;
+
+    uint64_t seed;
+    uint64_t v[4];
+    uint64_t total = 0;
+    unsigned char buf[32];
+    size_t buf_len = 0;
+
+    explicit Xxh64(uint64_t s = 0) : seed(s), v{s + P1 + P2, s + P2, s, s - P1} {}
+
+    void update(const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        total += len;
+        if (buf_len + len < 32) {
+            std::memcpy(buf + buf_len, p, len);
+            buf_len += len;
+            return;
+        }
+        if (buf_len) {
+            size_t fill = 32 - buf_len;
+            std::memcpy(buf + buf_len, p, fill);
+            consume(buf);
+            p += fill;
+            len -= fill;
+            buf_len = 0;
+        }
+        for (; len >= 32; p += 32, len -= 32) consume(p);
+        std::memcpy(buf, p, len);
+        buf_len = len;
+    }
+
+    uint64_t digest() const {
+        uint64_t h;
+        if (total >= 32) {
+            h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+            for (uint64_t x : v) h = (h ^ round(0, x)) * P1 + P4;
+        } else {
+            h = seed + P5;
+        }
+        h += total;
+
+        const unsigned char* p = buf;
+        size_t len = buf_len;
+        for (; len >= 8; p += 8, len -= 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+        if (len >= 4) {
+            h = rotl(h ^ (uint64_t)read32(p) * P1, 23) * P2 + P3;
+            p += 4;
+            len -= 4;
+        }
+        for (; len > 0; ++p, --len) h = rotl(h ^ (*p * P5), 11) * P1;
+
+        h ^= h >> 33; h *= P2;
+        h ^= h >> 29; h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t acc, uint64_t in) { return rotl(acc + in * P2, 31) * P1; }
+    static uint64_t read64(const unsigned char* p) { uint64_t x; std::memcpy(&x, p, 8); return x; }
+    static uint32_t read32(const unsigned char* p) { uint32_t x; std::memcpy(&x, p, 4); return x; }
+
+    void consume(const unsigned char* p) {
+        for (int i = 0; i < 4; ++i) v[i] = round(v[i], read64(p + 8 * i));
+    }
+};
+
+struct ContentStore;
+
+// Image body on its way into the store: hashed as it streams in, held in
+// memory and only spilled to a temp file past kMemLimit, so content that
+// is already stored costs no disk writes at all.
+struct CasBody {
+    static constexpr size_t kMemLimit = 16u << 20;
+
+    std::string mem;
+    fs::path spill_path;
+    std::ofstream spill;
+    // two seeds give a 128-bit content key
+    Xxh64 lo{0}, hi{0x9e3779b97f4a7c15ull};
+
+    // false on a failed spill write; the caller fails the download and
+    // discard()s, which removes the spill file
+    bool append(const char* p, size_t n, ContentStore& store);
+
+    std::string key() const {
+        char out[33];
+        std::snprintf(out, sizeof(out), "%016llx%016llx",
+                      (unsigned long long)hi.digest(), (unsigned long long)lo.digest());
+        return out;
+    }
+
+    void discard() {
+        std::string().swap(mem);
+        if (spill.is_open()) spill.close();
+        if (!spill_path.empty()) {
+            std::error_code ec;
+            fs::remove(spill_path, ec);
+            spill_path.clear();
+        }
+    }
+};
+
+// --cas output layout under out_dir:
+//
+//   objects/ab/abcdef...0123.jpg   one file per distinct body (128-bit key)
+//   manifest.tsv                   "url <TAB> key <TAB> objects/..." lines
+//   .tmp/                          bodies being committed, spills of very large ones
+//
+// The manifest is append-only; the last line for a URL wins.
+struct ContentStore {
+    fs::path root;
+    std::mutex mu;
+    std::unordered_map<std::string, std::string> manifest;   // url -> relative object path
+    std::ofstream manifest_out;
+    std::atomic<uint64_t> tmp_seq{0};   // unique temp names for concurrent commits
+
+    bool open(const fs::path& out_dir) {
+        root = out_dir;
+        std::error_code ec;
+        fs::create_directories(root / "objects", ec);
+        fs::create_directories(root / ".tmp", ec);
+        if (ec) return false;
+
+        std::ifstream in(root / "manifest.tsv");
+        std::string line;
+        while (std::getline(in, line)) {
+            auto t1 = line.find('\t');
+            auto t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+            if (t2 == std::string::npos) continue;
+            manifest[line.substr(0, t1)] = line.substr(t2 + 1);
+        }
+        manifest_out.open(root / "manifest.tsv", std::ios::app);
+        return (bool)manifest_out;
+    }
+
+    fs::path tmp_dir() const { return root / ".tmp"; }
+
+    // Fresh name under .tmp/, unique across workers.
+    fs::path tmp_path(const char* prefix) { return tmp_dir() / (prefix + std::to_string(tmp_seq++)); }
+
+    // Object a URL was last stored as, or empty if unknown.
+    fs::path lookup(const std::string& url) {
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = manifest.find(url);
+        return it == manifest.end() ? fs::path() : root / it->second;
+    }
+
+    // Files a finished body under its key. Sets `out` to the object path
+    // and `dup` if an identical object was already there (nothing written).
+    // Two workers may commit the same content at once: each lands its own
+    // temp file, and whichever finds the object already in place counts
+    // as the duplicate.
+    bool commit(const std::string& url, CasBody& body, fs::path& out, bool& dup) {
+        std::string key = body.key();
+        std::string ext = fs::path(filename_from_url(url)).extension().string();
+        for (char& c : ext) c = (char)std::tolower((unsigned char)c);
+        std::string shard = "objects/" + key.substr(0, 2);
+        std::string rel = shard + "/" + key + ext;
+        out = root / rel;
+
+        std::error_code ec;
+        dup = fs::exists(out, ec);
+        if (dup) {
+            body.discard();
+        } else {
+            // land under a temp name, then rename: readers never see half a file
+            fs::path tmp = body.spill_path;
+            if (body.spill.is_open()) {
+                body.spill.close();
+                if (!body.spill) {
+                    // a short spill must never be filed under the full body's key
+                    body.discard();
+                    return false;
+                }
+            } else {
+                tmp = tmp_path("obj-");
+                FileSink f;
+                bool wrote = f.open(tmp, (long long)body.mem.size(), false) &&
+                             f.write(body.mem.data(), body.mem.size());
+                if (!f.close() || !wrote) {
+                    body.discard();
+                    fs::remove(tmp, ec);
+                    return false;
+                }
+            }
+            fs::rename(tmp, out, ec);
+            if (ec == std::errc::no_such_file_or_directory) {
+                std::error_code ec2;
+                fs::create_directories(root / shard, ec2);
+                fs::rename(tmp, out, ec);
+            }
+            body.spill_path.clear();
+            body.discard();
+            if (ec) {
+                std::error_code ec2;
+                fs::remove(tmp, ec2);
+                if (!fs::exists(out, ec2)) return false;
+                dup = true;   // an identical body got there first
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mu);
+        auto& cur = manifest[url];
+        if (cur != rel) {
+            cur = rel;
+            manifest_out << url << '\t' << key << '\t' << rel << '\n';
+            manifest_out.flush();
+        }
+        return true;
+    }
+};
+
+bool CasBody::append(const char* p, size_t n, ContentStore& store) {
+    lo.update(p, n);
+    hi.update(p, n);
+    if (!spill.is_open() && mem.size() + n > kMemLimit) {
+        spill_path = store.tmp_path("spill-");
+        spill.open(spill_path, std::ios::binary | std::ios::trunc);
+        if (!spill) return false;
+        spill.write(mem.data(), (std::streamsize)mem.size());
+        std::string().swap(mem);
+        if (!spill.good()) return false;
+    }
+    if (spill.is_open()) return spill.write(p, (std::streamsize)n).good();
+    mem.append(p, n);
+    return true;
+}
+
+/* ===================== Metadata pipeline (--meta) ===================== */
+
+#ifdef SPIDER_WITH_META
+
+// Image bodies handed over by finished downloads, parsed with scorpion's
+// extractor on a pool of threads while the crawl goes on, so metadata
+// does not wait for a write-then-read of every file. Records are
+// appended to an NDJSON file in completion order.
+struct MetaPipeline {
+    struct Job {
+        std::string url;
+        fs::path path;      // saved file, empty if the image is not kept
+        std::string body;   // empty: parse `path` (too large to hold, or a 304)
+    };
+
+    meta::FieldFilter fields;
+    bool save_images = true;        // false (--meta-only): bodies only go here
+    size_t max_body = 64 << 20;     // bodies held in memory up to this size
+    size_t queue_cap = 64;          // finished downloads wait when it is full
+
+    std::mutex mu;
+    std::condition_variable not_empty, not_full;
+    std::deque<Job> jobs;
+    bool closing = false;
+    std::vector<std::thread> workers;
+
+    std::mutex out_mu;
+    std::FILE* out = nullptr;
+    std::string buf;                // rendered records not yet written
+    std::atomic<uint64_t> records{0};
+
+    MetaPipeline() = default;
+    MetaPipeline(const MetaPipeline&) = delete;
+    MetaPipeline& operator=(const MetaPipeline&) = delete;
+    ~MetaPipeline() { stop(); }
+
+    bool start(const fs::path& file, const std::string& field_list, int threads) {
+        out = std::fopen(file.c_str(), "wb");
+        if (!out) return false;
+        fields = meta::parse_fields(field_list);
+        // Exiv2's XMP toolkit must be set up once before threads use it
+        Exiv2::XmpParser::initialize();
+        for (int i = 0; i < std::max(1, threads); ++i) workers.emplace_back([this] { run(); });
+        return true;
+    }
+
+    void submit(std::string url, fs::path path, std::string body) {
+        std::unique_lock<std::mutex> lock(mu);
+        not_full.wait(lock, [&] { return jobs.size() < queue_cap; });
+        jobs.push_back({std::move(url), std::move(path), std::move(body)});
+        lock.unlock();
+        not_empty.notify_one();
+    }
+
+    // Parses what is still queued, then closes the output.
+    void stop() {
+        if (!out) return;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            closing = true;
+        }
+        not_empty.notify_all();
+        for (auto& w : workers) w.join();
+        workers.clear();
+        std::fwrite(buf.data(), 1, buf.size(), out);
+        std::fclose(out);
+        out = nullptr;
+        Exiv2::XmpParser::terminate();
+    }
+
+    void run() {
+        std::string line;
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mu);
+                not_empty.wait(lock, [&] { return !jobs.empty() || closing; });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            not_full.notify_one();
+
+            meta::FileRecord rec;
+            rec.url = std::move(job.url);
+            rec.path = job.path.string();
+            std::error_code ec;
+            if (!job.body.empty() || job.path.empty()) {
+                rec.size = job.body.size();
+                rec.has_size = true;
+                meta::read_meta(meta::MetaSource::from_memory(job.body.data(), job.body.size()), fields, rec);
+            } else {
+                rec.size = fs::file_size(job.path, ec);
+                rec.has_size = !ec;
+                meta::read_meta(meta::MetaSource::from_file(job.path), fields, rec);
+            }
+
+            line.clear();
+            meta::write_ndjson(line, rec);
+            std::lock_guard<std::mutex> lock(out_mu);
+            buf += line;
+            if (buf.size() >= (1 << 20)) {
+                std::fwrite(buf.data(), 1, buf.size(), out);
+                buf.clear();
+            }
+            records.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+#else
+
+// Built without Exiv2: --meta is not offered, so no pipeline is started.
+struct MetaPipeline {
+    bool save_images = true;
+    size_t max_body = 0;
+    std::atomic<uint64_t> records{0};
+
+    bool start(const fs::path&, const std::string&, int) { return false; }
+    void submit(std::string, fs::path, std::string) {}
+    void stop() {}
+};
+
+#endif // SPIDER_WITH_META
+
+/* ===================== libcurl helpers ===================== */
+
+// Everything a transfer needs besides its URL; owned by Spider and shared
+// by all workers.
+struct FetchContext {
+    std::string user_agent;
+    CurlPool* pool = nullptr;
+    HttpCache* cache = nullptr;   // optional (--cache)
+    ContentStore* cas = nullptr;  // optional (--cas)
+    bool direct_io = false;       // O_DIRECT image writes (--direct-io)
+    bool sniff = true;            // Content-Type + magic checks (--no-sniff)
+    long long max_size = 0;       // image size cap in bytes (--max-size), 0 = none
+    Telemetry* stats = nullptr;   // optional
+    MetaPipeline* pipeline = nullptr; // optional (--meta): bodies also go to the extractor
+    long long meta_range = 0;     // --meta-range: first request size for metadata prefixes
+};
+
+template <class Str>
+static size_t write_to_string(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total = size * nmemb;
+    auto* s = static_cast<Str*>(userp);
+    s->append(static_cast<char*>(contents), total);
+    return total;
+}
+
+static void setup_page_request(CURL* curl, const std::string& url, const std::string& user_agent) {
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 15L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.c_str());
+}
+
+static long response_code(CURL* curl) {
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    return code;
+}
+
+static bool response_ok(CURL* curl) {
+    long code = response_code(curl);
+    return code >= 200 && code < 300;
+}
+
+/* Streaming page sink: body chunks go straight into the tag scanner. */
+struct PageStream {
+    CURL* curl = nullptr;
+    HtmlStreamScanner scanner;
+    std::function<void(HtmlRef, std::string_view)> emit;
+    uint64_t extract_ns = 0;
+};
+
+static size_t write_to_scanner(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total = size * nmemb;
+    auto* ps = static_cast<PageStream*>(userp);
+    // error pages are consumed but not parsed
+    if (response_ok(ps->curl)) {
+        ScopedTimer timer(ps->extract_ns);
+        ps->scanner.feed(std::string_view(static_cast<char*>(contents), total), ps->emit);
+    }
+    return total;
+}
+
+template <class Str>
+static bool read_file(const fs::path& p, Str& out) {
+    std::ifstream in(p, std::ios::binary);
+    if (!in) return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// A page GET split around its transfer, so the blocking and event-loop
+// engines share it: begin() sets up `curl`, finish() settles the result.
+// With a cache, a page we have a stored copy of is fetched conditionally
+// and a 304 answer is served from that copy. `out` is a std::string or a
+// page body in a worker's arena.
+template <class Str>
+struct PageRequest {
+    const std::string& url;
+    Str& out;
+    const FetchContext& ctx;
+    CURL* curl = nullptr;
+    ResponseMeta meta;
+    curl_slist* headers = nullptr;
+    std::optional<HttpCache::Entry> cached;
+    fs::path cached_body;
+
+    PageRequest(const std::string& u, Str& o, const FetchContext& c) : url(u), out(o), ctx(c) {}
+
+    bool begin() {
+        curl = ctx.pool->acquire();
+        if (!curl) return false;
+
+        setup_page_request(curl, url, ctx.user_agent);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_string<Str>);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+
+        if (ctx.cache) {
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, on_header);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, &meta);
+            cached_body = ctx.cache->page_path(url);
+            cached = ctx.cache->lookup(url);
+            std::error_code ec;
+            if (cached && fs::exists(cached_body, ec)) {
+                headers = conditional_headers(*cached);
+                curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            } else {
+                cached.reset();
+            }
+        }
+        return true;
+    }
+
+    bool finish(CURLcode res) {
+        long code = response_code(curl);
+        if (ctx.stats) ctx.stats->record_transfer(curl, false);
+        ctx.pool->release(curl);
+        curl = nullptr;
+        curl_slist_free_all(headers);
+        headers = nullptr;
+
+        if (res != CURLE_OK) return false;
+        if (code == 304 && cached) return read_file(cached_body, out);
+        if (!(code >= 200 && code < 300)) return false;
+
+        if (ctx.cache && (!meta.etag.empty() || !meta.last_modified.empty()) &&
+            ctx.cache->write_page(url, std::string_view(out.data(), out.size()))) {
+            ctx.cache->store(url, meta);
+        }
+        return true;
+    }
+};
+
+template <class Str>
+static bool http_get_text(const std::string& url, Str& out, const FetchContext& ctx) {
+    PageRequest<Str> req(url, out, ctx);
+    if (!req.begin()) return false;
+    return req.finish(curl_easy_perform(req.curl));
+}
+
+/* One image transfer: target file, open stream and its easy handle. */
+struct Download {
+    std::string url;
+    std::string host;
+    fs::path out_path;
+    FileSink sink;
+    CURL* curl = nullptr;
+    ResponseMeta meta;
+    curl_slist* headers = nullptr;   // conditional GET, if any
+    bool opened = false;             // 2xx body started
+    bool created = false;            // out_path truncated and being written
+    bool not_modified = false;       // 304: kept the file we already had
+    bool direct_io = false;
+    bool sniff = false;
+    bool sniffed = false;            // magic checked, `head` passed on
+    std::string head;                // first bytes, held back until sniffed
+    long long max_size = 0;
+    long long received = 0;
+    uint64_t write_ns = 0;           // time spent in output I/O
+    std::string error;               // why a 2xx body was refused
+    ContentStore* cas = nullptr;     // --cas: body goes to `body`, not sink
+    CasBody body;
+    bool duplicate = false;          // --cas: content was already stored
+    MetaPipeline* pipeline = nullptr; // --meta: body is also kept in `mem`
+    bool save = true;                // false with --meta-only: nothing on disk
+    std::string mem;
+    bool mem_overflow = false;       // body outgrew meta->max_body
+    long long range = 0;             // --meta-range: fetch bytes [mem.size(), range)
+    bool prefix_done = false;        // metadata prefix complete, transfer cut short
+    bool again = false;              // prefix incomplete: settled, to be re-requested
+    int requests = 0;
+};
+
+// Hands body bytes to the store or the output file; the file is created
+// only here, so a refused or failed response never touches what is
+// already on disk.
+static bool deliver(Download& d, const char* p, size_t n) {
+    if (d.pipeline && !d.mem_overflow) {
+        if (d.mem.size() + n <= d.pipeline->max_body) {
+            d.mem.append(p, n);
+        } else {
+            d.mem_overflow = true;   // parsed from the saved file instead
+            std::string().swap(d.mem);
+        }
+    }
+    if (!d.save) {
+        if (d.mem_overflow) d.error = "too large to parse in memory";
+        return !d.mem_overflow;
+    }
+    if (d.cas) return d.body.append(p, n, *d.cas);
+    if (!d.created) {
+        curl_off_t length = -1;
+        if (d.curl) curl_easy_getinfo(d.curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        if (!d.sink.open(d.out_path, length, d.direct_io)) return false;
+        d.created = true;
+    }
+    return d.sink.write(p, n);
+}
+
+// Feeds the magic check; `final` at end of body, when no more bytes come.
+static bool sniff_step(Download& d, const char* p, size_t n, bool final) {
+    d.head.append(p, n);
+    Sniff r = sniff_image(d.head);
+    if (r == Sniff::NeedMore && !final) return true;
+    if (r != Sniff::Image) {
+        d.error = "bad magic bytes";
+        return false;
+    }
+    d.sniffed = true;
+    bool ok = deliver(d, d.head.data(), d.head.size());
+    std::string().swap(d.head);
+    return ok;
+}
+
+static size_t write_to_file(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total = size * nmemb;
+    auto* d = static_cast<Download*>(userp);
+    const char* p = static_cast<const char*>(contents);
+    if (!d->opened) {
+        if (!response_ok(d->curl)) return total;
+        d->opened = true;
+        // a server that ignores Range starts over from byte 0, on the
+        // first request or on any follow-up
+        if (d->range > 0 && response_code(d->curl) == 200) d->mem.clear();
+        if (d->sniff) {
+            const char* ct = nullptr;
+            curl_easy_getinfo(d->curl, CURLINFO_CONTENT_TYPE, &ct);
+            if (ct && !image_content_type_ok(ct)) {
+                d->error = std::string("Content-Type ") + ct;
+                return 0;   // aborts the transfer
+            }
+        }
+        if (d->cas || d->pipeline) {
+            curl_off_t length = -1;
+            curl_easy_getinfo(d->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            if (d->cas) d->body.mem.reserve((size_t)std::clamp<curl_off_t>(length, 0, CasBody::kMemLimit));
+            // a follow-up 206 continues what is already held
+            curl_off_t want = (curl_off_t)d->mem.size() + std::max<curl_off_t>(length, 0);
+            if (d->pipeline) d->mem.reserve((size_t)std::min(want, (curl_off_t)d->pipeline->max_body));
+        }
+    }
+    // CURLOPT_MAXFILESIZE only sees Content-Length; this catches chunked bodies
+    d->received += (long long)total;
+    if (d->max_size > 0 && d->received > d->max_size) {
+        d->error = "larger than " + std::to_string(d->max_size) + " bytes";
+        return 0;
+    }
+    ScopedTimer timer(d->write_ns);
+    bool ok = d->sniff && !d->sniffed ? sniff_step(*d, p, total, false) : deliver(*d, p, total);
+    if (ok && d->range > 0) {
+        size_t keep;
+        if (meta_prefix(d->mem, keep) == Prefix::Complete) {
+            end_meta_prefix(d->mem, keep);
+            d->prefix_done = true;
+            return 0;   // the rest of the image is not needed
+        }
+    }
+    return ok ? total : 0;
+}
+
+static bool download_begin(Download& d, const FetchContext& ctx) {
+    d.pipeline = ctx.pipeline;
+    d.save = !d.pipeline || (d.pipeline->save_images && ctx.meta_range == 0);
+    if (d.pipeline && ctx.meta_range > 0 && d.range == 0) d.range = ctx.meta_range;
+    d.again = false;
+    d.opened = false;   // every range request is a new response to check
+    ++d.requests;
+    // --cas: out_path is the object this URL was stored as last time, if any
+    d.cas = d.save ? ctx.cas : nullptr;
+    d.direct_io = ctx.direct_io;
+    d.sniff = ctx.sniff;
+    d.max_size = ctx.max_size;
+
+    d.curl = ctx.pool->acquire();
+    if (!d.curl) return false;
+
+    curl_easy_setopt(d.curl, CURLOPT_URL, d.url.c_str());
+    curl_easy_setopt(d.curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(d.curl, CURLOPT_MAXREDIRS, 10L);
+    curl_easy_setopt(d.curl, CURLOPT_TIMEOUT, 30L);
+    curl_easy_setopt(d.curl, CURLOPT_USERAGENT, ctx.user_agent.c_str());
+    curl_easy_setopt(d.curl, CURLOPT_WRITEFUNCTION, write_to_file);
+    curl_easy_setopt(d.curl, CURLOPT_WRITEDATA, &d);
+    curl_easy_setopt(d.curl, CURLOPT_PRIVATE, &d);
+    // wait for a multiplexable HTTP/2 connection instead of opening another
+    curl_easy_setopt(d.curl, CURLOPT_PIPEWAIT, 1L);
+    if (d.max_size > 0) curl_easy_setopt(d.curl, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t)d.max_size);
+    if (d.range > 0) {
+        std::string r = std::to_string(d.mem.size()) + "-" + std::to_string(d.range - 1);
+        curl_easy_setopt(d.curl, CURLOPT_RANGE, r.c_str());   // libcurl copies it
+        curl_easy_setopt(d.curl, CURLOPT_HEADERFUNCTION, on_header);
+        curl_easy_setopt(d.curl, CURLOPT_HEADERDATA, &d.meta);
+    }
+
+    if (ctx.cache && d.range == 0) {
+        curl_easy_setopt(d.curl, CURLOPT_HEADERFUNCTION, on_header);
+        curl_easy_setopt(d.curl, CURLOPT_HEADERDATA, &d.meta);
+        // revalidate only if the file we would keep is still there, whole
+        auto e = ctx.cache->lookup(d.url);
+        std::error_code ec;
+        if (e && fs::exists(d.out_path, ec) &&
+            (e->length < 0 || (long long)fs::file_size(d.out_path, ec) == e->length)) {
+            d.headers = conditional_headers(*e);
+            curl_easy_setopt(d.curl, CURLOPT_HTTPHEADER, d.headers);
+        }
+    }
+    return true;
+}
+
+// Finishes the output side of a completed transfer: closes or files the
+// body, or removes what a failed one left behind.
+static bool settle_download(Download& d, CURLcode res, long code, bool revalidated,
+                            const FetchContext& ctx) {
+    bool ok = (res == CURLE_OK || d.prefix_done) && code >= 200 && code < 300;
+    if (ok && code == 206 && !d.prefix_done) {
+        // the prefix ended before the metadata did: ask for more, at least
+        // four times as much, unless that was the whole file. With no total
+        // ("bytes a-b/*"), a response short of what was asked for is EOF.
+        long long total = d.meta.range_total;
+        long long have = (long long)d.mem.size();
+        bool more = total < 0 ? have >= d.range : have < total;
+        if (more) {
+            size_t need = 0;
+            Prefix p = meta_prefix(d.mem, need);
+            long long next = p == Prefix::Unknown && total > 0 ? total : d.range * 4;
+            d.range = std::max(next, (long long)need);
+            d.again = true;
+            return true;
+        }
+    }
+    if (res == CURLE_FILESIZE_EXCEEDED) d.error = "larger than " + std::to_string(d.max_size) + " bytes";
+    // a body shorter than the longest magic is decided here
+    if (ok && d.sniff && !d.sniffed && !sniff_step(d, nullptr, 0, true)) ok = false;
+    if (ok && !d.created && !d.cas && d.save) {
+        // empty 2xx body (only without sniffing): still leave an empty file
+        ok = d.sink.open(d.out_path, 0, false);
+        d.created = ok;
+    }
+    if (d.sink.is_open() && !d.sink.close()) ok = false;
+
+    if (res == CURLE_OK && code == 304 && revalidated) {
+        d.not_modified = true;
+        if (d.pipeline) d.pipeline->submit(d.url, d.out_path, {});
+        return true;
+    }
+    if (!ok) {
+        // cleanup partial file
+        if (d.cas) {
+            d.body.discard();
+        } else if (d.created) {
+            std::error_code ec;
+            fs::remove(d.out_path, ec);
+        }
+        return false;
+    }
+    if (d.cas && !d.cas->commit(d.url, d.body, d.out_path, d.duplicate)) return false;
+    if (ctx.cache && d.save) ctx.cache->store(d.url, d.meta);
+    if (d.pipeline) d.pipeline->submit(d.url, d.save ? d.out_path : fs::path(), std::move(d.mem));
+    return true;
+}
+
+static bool download_end(Download& d, CURLcode res, const FetchContext& ctx) {
+    long code = response_code(d.curl);
+    if (ctx.stats) ctx.stats->record_transfer(d.curl, true);
+    ctx.pool->release(d.curl);
+    d.curl = nullptr;
+    bool revalidated = d.headers != nullptr;
+    curl_slist_free_all(d.headers);
+    d.headers = nullptr;
+
+    bool ok;
+    {
+        ScopedTimer timer(d.write_ns);
+        ok = settle_download(d, res, code, revalidated, ctx);
+    }
+    if (ctx.stats && !d.again) {
+        ctx.stats->write.record(d.write_ns / 1000);
+        (ok ? ctx.stats->images : ctx.stats->images_failed).fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
+
+static void log_download(const Download& d, bool ok) {
+    if (!ok) {
+        log_event(LogLevel::Warn, LogEvent::ImageFailed, d.url, d.error);
+        return;
+    }
+    std::string note = d.not_modified ? "not modified" : d.duplicate ? "duplicate" : "";
+    if (d.range > 0) {
+        note = "metadata only, " + std::to_string(d.received) + " B in " + std::to_string(d.requests) +
+               (d.requests == 1 ? " request" : " requests");
+    }
+    log_event(LogLevel::Info, LogEvent::Image, d.url, d.save ? d.out_path.string() : "(not saved)", note);
+}
+
+static bool http_download_file(Download& d, const FetchContext& ctx) {
+    bool ok;
+    do {
+        if (!download_begin(d, ctx)) return false;
+        CURLcode res = curl_easy_perform(d.curl);
+        ok = download_end(d, res, ctx);
+    } while (d.again);
+    return ok;
+}
+
+/* ===================== Per-host politeness ===================== */
+
+// Rules from one robots.txt group. Paths match by prefix, with '*' for
+// any run of characters and a trailing '$' anchoring the end; the longest
+// matching rule wins, Allow on a tie.
+struct RobotsRules {
+    struct Rule {
+        bool allow;
+        std::string pattern;
+    };
+    std::vector<Rule> rules;
+    double crawl_delay = 0;  // seconds, 0 if not given
+
+    // Prefix match with '*' wildcards, whole-path with a trailing '$'.
+    // Two pointers, resuming after the last '*' on a mismatch, so no
+    // pattern can make this worse than linear in pattern times path.
+    static bool match(std::string_view pat, std::string_view path) {
+        bool anchored = !pat.empty() && pat.back() == '$';
+        if (anchored) pat.remove_suffix(1);
+        size_t p = 0, i = 0, star = std::string_view::npos, mark = 0;
+        while (i < path.size()) {
+            if (p == pat.size() && !anchored) return true;
+            if (p < pat.size() && pat[p] == '*') {
+                star = p++;
+                mark = i;
+            } else if (p < pat.size() && pat[p] == path[i]) {
+                ++p;
+                ++i;
+            } else if (star != std::string_view::npos) {
+                p = star + 1;
+                i = ++mark;
+            } else {
+                return false;
+            }
+        }
+        while (p < pat.size() && pat[p] == '*') ++p;
+        return p == pat.size();
+    }
+
+    bool allowed(std::string_view path) const {
+        size_t best = 0;
+        bool allow = true;
+        for (const auto& r : rules) {
+            if (r.pattern.size() < best || !match(r.pattern, path)) continue;
+            if (r.pattern.size() > best || r.allow) allow = r.allow;
+            best = r.pattern.size();
+        }
+        return allow;
+    }
+};
+
+// The product token robots.txt groups are matched against: the last
+// product of a User-Agent header outside (comments), without its
+// version, e.g. "ArachnidaSpider" for "Mozilla/5.0 (...) ArachnidaSpider/1.0".
+static std::string robots_token(std::string_view ua) {
+    std::string_view last;
+    int depth = 0;
+    size_t i = 0;
+    while (i < ua.size()) {
+        char c = ua[i];
+        if (c == '(') ++depth;
+        if (c == ')' && depth > 0) --depth;
+        if (depth > 0 || c == ')' || c == ' ') {
+            ++i;
+            continue;
+        }
+        size_t end = ua.find_first_of(" (", i);
+        if (end == std::string_view::npos) end = ua.size();
+        last = ua.substr(i, end - i);
+        i = end;
+    }
+    last = last.substr(0, last.find('/'));
+    return last.empty() ? std::string("ArachnidaSpider") : std::string(last);
+}
+
+// Picks the group naming `agent` (case-insensitive substring of the
+// User-agent value), falling back to the "*" group.
+static RobotsRules parse_robots(std::string_view text, std::string_view agent) {
+    RobotsRules mine, star;
+    bool have_mine = false;
+    bool in_mine = false, in_star = false, group_open = false;
+
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        std::string_view line = text.substr(0, nl);
+        text = nl == std::string_view::npos ? std::string_view() : text.substr(nl + 1);
+
+        auto hash = line.find('#');
+        if (hash != std::string_view::npos) line = line.substr(0, hash);
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) continue;
+        std::string_view key = trim_view(line.substr(0, colon));
+        std::string_view value = trim_view(line.substr(colon + 1));
+
+        if (iequals(key, "user-agent")) {
+            if (!group_open) {
+                in_mine = in_star = false;
+                group_open = true;
+            }
+            if (value == "*") {
+                in_star = true;
+            } else {
+                std::string v(value);
+                for (char& c : v) c = (char)std::tolower((unsigned char)c);
+                std::string a(agent);
+                for (char& c : a) c = (char)std::tolower((unsigned char)c);
+                if (!v.empty() && a.find(v) != std::string::npos) in_mine = have_mine = true;
+            }
+            continue;
+        }
+        group_open = false;
+
+        bool allow = iequals(key, "allow");
+        if (allow || iequals(key, "disallow")) {
+            // "Disallow:" with no path allows everything
+            if (value.empty()) continue;
+            if (in_mine) mine.rules.push_back({allow, std::string(value)});
+            if (in_star) star.rules.push_back({allow, std::string(value)});
+        } else if (iequals(key, "crawl-delay")) {
+            double d = std::atof(std::string(value).c_str());
+            if (in_mine) mine.crawl_delay = d;
+            if (in_star) star.crawl_delay = d;
+        }
+    }
+    return have_mine ? mine : star;
+}
+
+// Sits between the frontier and the fetchers: at most max_conns requests
+// per host at once, started no closer than 1/rps seconds apart (or the
+// host's robots.txt Crawl-delay, if longer), plus a robots.txt cache that
+// fetches each host's file exactly once. Shared by all workers.
+struct HostScheduler {
+    using Clock = std::chrono::steady_clock;
+
+    int max_conns = 0;      // 0 = unlimited
+    double rps = 0;         // 0 = unlimited
+    std::string agent = "ArachnidaSpider";   // robots.txt product token, see robots_token()
+
+    struct Host {
+        int active = 0;
+        Clock::time_point next_start{};
+        bool robots_state = false;  // fetch finished
+        bool robots_loading = false;
+        RobotsRules robots;
+        // event-loop tasks parked until a slot frees / the rules are in
+        std::deque<std::function<void()>> slot_waiters;
+        std::vector<std::function<void()>> robots_waiters;
+    };
+
+    std::mutex mu;
+    std::condition_variable robots_cv;
+    std::unordered_map<std::string, Host> hosts;
+
+    static std::string key(std::string_view host) {
+        std::string k(host);
+        for (char& c : k) c = (char)std::tolower((unsigned char)c);
+        return k;
+    }
+
+    // Takes a request slot for `host` if one is free right now; otherwise
+    // sets retry_at to when it is worth asking again. With `on_free`, a
+    // host at max_conns queues it instead, for release() to call, and sets
+    // retry_at to Clock::time_point::max().
+    bool try_acquire(std::string_view host, Clock::time_point& retry_at,
+                     std::function<void()> on_free = {}) {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mu);
+        Host& h = hosts[key(host)];
+        if (max_conns > 0 && h.active >= max_conns) {
+            if (on_free) {
+                h.slot_waiters.push_back(std::move(on_free));
+                retry_at = Clock::time_point::max();
+            } else {
+                // a slot frees when a transfer ends; check back soon
+                retry_at = now + std::chrono::milliseconds(20);
+            }
+            return false;
+        }
+        if (now < h.next_start) {
+            retry_at = h.next_start;
+            return false;
+        }
+        double gap = rps > 0 ? 1.0 / rps : 0;
+        gap = std::max(gap, h.robots.crawl_delay);
+        h.next_start = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap));
+        ++h.active;
+        return true;
+    }
+
+    void release(std::string_view host) {
+        std::function<void()> wake;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            Host& h = hosts[key(host)];
+            if (h.active > 0) --h.active;
+            if (!h.slot_waiters.empty()) {
+                wake = std::move(h.slot_waiters.front());
+                h.slot_waiters.pop_front();
+            }
+        }
+        if (wake) wake();
+    }
+
+    // Rules for u's host; the first caller per host runs `fetch` (outside
+    // the lock) while any others wait for its result.
+    template <class Fetch>
+    bool robots_allowed(const UrlParts& u, Fetch&& fetch) {
+        if (robots_begin(u) == Robots::Fetch) {
+            std::string body;
+            bool ok = fetch(std::string(u.origin()) + "/robots.txt", body);
+            robots_done(u, ok, body);
+        }
+        std::string k = key(u.host());
+        std::unique_lock<std::mutex> lock(mu);
+        robots_cv.wait(lock, [&] { return hosts[k].robots_state; });
+        return hosts[k].robots.allowed(u.path());
+    }
+
+    // The same without blocking, for the event loop: robots_begin() says
+    // whether the rules are in, whether the caller is the one to fetch
+    // them (and must call robots_done()), or whether they are still on
+    // their way, in which case `on_ready` is queued for robots_done().
+    enum class Robots { Ready, Fetch, Loading };
+
+    Robots robots_begin(const UrlParts& u, std::function<void()> on_ready = {}) {
+        std::lock_guard<std::mutex> lock(mu);
+        Host& h = hosts[key(u.host())];
+        if (h.robots_state) return Robots::Ready;
+        if (h.robots_loading) {
+            if (on_ready) h.robots_waiters.push_back(std::move(on_ready));
+            return Robots::Loading;
+        }
+        h.robots_loading = true;
+        return Robots::Fetch;
+    }
+
+    void robots_done(const UrlParts& u, bool ok, std::string_view body) {
+        std::vector<std::function<void()>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            Host& h = hosts[key(u.host())];
+            // a missing or unreadable robots.txt allows everything
+            if (ok) h.robots = parse_robots(body, agent);
+            h.robots_state = true;
+            h.robots_loading = false;
+            waiters.swap(h.robots_waiters);
+            robots_cv.notify_all();
+        }
+        for (auto& wake : waiters) wake();
+    }
+
+    // Only once robots_begin() has returned Ready.
+    bool robots_check(const UrlParts& u) {
+        std::lock_guard<std::mutex> lock(mu);
+        return hosts[key(u.host())].robots.allowed(u.path());
+    }
+};
+
+/* ===================== Concurrent downloads (curl multi) ===================== */
+
+// Keeps up to max_parallel image transfers in flight on one curl multi handle.
+// Jobs queue up across pages; run(false) makes progress without blocking,
+// run(true) waits until everything queued so far has finished.
+// stream_page() drives a page fetch on the same multi handle, so images it
+// discovers start downloading while the rest of the page is still arriving.
+// Waiting jobs sit in one queue per host and start round-robin as the
+// HostScheduler hands out slots.
+struct DownloadEngine {
+    using Clock = HostScheduler::Clock;
+
+    int max_parallel = 8;
+    const FetchContext* ctx = nullptr;
+    HostScheduler* hosts = nullptr;   // optional
+    // optional gate (robots.txt) run before a job starts, outside any
+    // curl callback; a refused job is logged and dropped
+    std::function<bool(const Download&)> admit;
+    // optional hook called once per job when it is settled
+    std::function<void(const Download&, bool ok)> on_done;
+
+    CURLM* multi = nullptr;
+    std::unordered_map<std::string, std::deque<std::unique_ptr<Download>>> queued;
+    std::deque<std::string> host_order;   // hosts with queued jobs, round-robin
+    size_t queued_count = 0;
+    std::unordered_map<CURL*, std::unique_ptr<Download>> active;
+
+    // page currently being streamed, if any
+    CURL* page = nullptr;
+    bool page_done = false;
+    CURLcode page_res = CURLE_OK;
+
+    DownloadEngine() : multi(curl_multi_init()) {
+        if (multi) curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    }
+    ~DownloadEngine() {
+        // still running at teardown: settled, logged and journaled like any other
+        for (auto& kv : active) {
+            Download& d = *kv.second;
+            curl_multi_remove_handle(multi, kv.first);
+            bool ok = download_end(d, CURLE_ABORTED_BY_CALLBACK, *ctx);
+            if (!ok && d.error.empty()) d.error = "aborted";
+            finished(d, ok);
+        }
+        if (multi) curl_multi_cleanup(multi);
+    }
+    DownloadEngine(const DownloadEngine&) = delete;
+    DownloadEngine& operator=(const DownloadEngine&) = delete;
+
+    void add(const std::string& url, std::string_view host, const fs::path& out_path) {
+        auto d = std::make_unique<Download>();
+        d->url = url;
+        d->host = HostScheduler::key(host);
+        d->out_path = out_path;
+        auto& q = queued[d->host];
+        if (q.empty()) host_order.push_back(d->host);
+        q.push_back(std::move(d));
+        ++queued_count;
+    }
+
+    bool idle() const { return queued_count == 0 && active.empty(); }
+
+    // Hands every job not yet started to the caller (the event loop takes
+    // over images queued by a checkpoint resume this way).
+    std::vector<std::unique_ptr<Download>> take_queued() {
+        std::vector<std::unique_ptr<Download>> out;
+        for (const auto& host : host_order) {
+            for (auto& d : queued[host]) out.push_back(std::move(d));
+        }
+        queued.clear();
+        host_order.clear();
+        queued_count = 0;
+        return out;
+    }
+
+    void run(bool block) {
+        for (;;) {
+            Clock::time_point wake = fill();
+            if (active.empty()) {
+                // everything left is waiting for a host slot
+                if (queued_count == 0 || !block) return;
+                std::this_thread::sleep_until(wake);
+                continue;
+            }
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            reap();
+
+            if (!block) {
+                fill();
+                return;
+            }
+            if (idle()) return;
+            if (running > 0) curl_multi_poll(multi, nullptr, 0, wait_ms(wake), nullptr);
+        }
+    }
+
+    // One round of progress, then wait up to timeout_ms for socket activity.
+    void poll(int timeout_ms) {
+        fill();
+        if (active.empty()) return;
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        reap();
+        Clock::time_point wake = fill();
+        if (!active.empty()) {
+            curl_multi_poll(multi, nullptr, 0, std::min(timeout_ms, wait_ms(wake)), nullptr);
+        }
+    }
+
+    bool stream_page(const std::string& url, PageStream& ps) {
+        CURL* curl = ctx->pool->acquire();
+        if (!curl) return false;
+
+        setup_page_request(curl, url, ctx->user_agent);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_scanner);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ps);
+        ps.curl = curl;
+
+        if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+            ctx->pool->release(curl);
+            return false;
+        }
+        page = curl;
+        page_done = false;
+
+        // downloads queued by the scanner are only attached in fill(),
+        // never from inside the write callback
+        while (!page_done) {
+            fill();
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            reap();
+            if (!page_done && running > 0) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+        page = nullptr;
+
+        bool ok = page_res == CURLE_OK && response_ok(curl);
+        if (ok) {
+            ScopedTimer timer(ps.extract_ns);
+            ps.scanner.finish(ps.emit);
+        }
+        if (ctx->stats) {
+            ctx->stats->record_transfer(curl, false);
+            ctx->stats->extract.record(ps.extract_ns / 1000);
+        }
+        ctx->pool->release(curl);
+        return ok;
+    }
+
+private:
+    static int wait_ms(Clock::time_point wake) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - Clock::now()).count();
+        return (int)std::max<long long>(1, std::min<long long>(ms, 1000));
+    }
+
+    // Starts queued jobs while there is room, visiting hosts round-robin.
+    // Returns the earliest time a host that said "not yet" may be retried.
+    Clock::time_point fill() {
+        Clock::time_point wake = Clock::now() + std::chrono::seconds(1);
+        size_t refused = 0;
+        while ((int)active.size() < max_parallel && refused < host_order.size()) {
+            std::string host = std::move(host_order.front());
+            host_order.pop_front();
+            auto q = queued.find(host);
+
+            if (admit && !admit(*q->second.front())) {
+                log_event(LogLevel::Info, LogEvent::Disallowed, q->second.front()->url);
+                if (on_done) on_done(*q->second.front(), false);
+                q->second.pop_front();
+                --queued_count;
+                if (q->second.empty()) queued.erase(q);
+                else host_order.push_back(std::move(host));
+                continue;
+            }
+
+            Clock::time_point retry_at;
+            if (hosts && !hosts->try_acquire(host, retry_at)) {
+                wake = std::min(wake, retry_at);
+                host_order.push_back(std::move(host));
+                ++refused;
+                continue;
+            }
+            refused = 0;
+
+            auto d = std::move(q->second.front());
+            q->second.pop_front();
+            --queued_count;
+            if (q->second.empty()) queued.erase(q);
+            else host_order.push_back(std::move(host));
+            start(std::move(d));
+        }
+        return wake;
+    }
+
+    void start(std::unique_ptr<Download> d) {
+        if (!download_begin(*d, *ctx)) {
+            finished(*d, false);
+            return;
+        }
+        if (curl_multi_add_handle(multi, d->curl) != CURLM_OK) {
+            finished(*d, download_end(*d, CURLE_FAILED_INIT, *ctx));
+            return;
+        }
+        CURL* h = d->curl;
+        active.emplace(h, std::move(d));
+    }
+
+    void finished(const Download& d, bool ok) {
+        if (hosts) hosts->release(d.host);
+        log_download(d, ok);
+        if (on_done) on_done(d, ok);
+    }
+
+    void reap() {
+        int left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL* h = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(multi, h);
+
+            if (h == page) {
+                page_done = true;
+                page_res = res;
+                continue;
+            }
+            auto it = active.find(h);
+            if (it == active.end()) continue;
+            std::unique_ptr<Download> d = std::move(it->second);
+            active.erase(it);
+            bool ok = download_end(*d, res, *ctx);
+            if (d->again) {
+                start(std::move(d));   // next range, same host slot
+                continue;
+            }
+            finished(*d, ok);
+        }
+    }
+};
+
+/* ===================== Event loop (--engine async) ===================== */
+
+#ifdef SPIDER_ASYNC
+
+// One curl multi handle driven by curl_multi_socket_action() over epoll,
+// with a timerfd for libcurl's timeouts and for coroutines that sleep.
+// Crawl steps are coroutines on it: `co_await loop.perform(easy)` parks a
+// task until its transfer is done and `co_await loop.sleep_until(t)`
+// until a host may be asked again, so one thread keeps any number of
+// transfers going while a page task still reads top to bottom.
+// Everything here runs on the loop's own thread, except post().
+struct AsyncLoop {
+    using Clock = HostScheduler::Clock;
+
+    // A detached task: started by spawn(), frees itself when it returns.
+    struct Task {
+        struct promise_type {
+            size_t* live = nullptr;
+
+            Task get_return_object() { return Task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+            ~promise_type() {
+                if (live) --*live;
+            }
+        };
+        std::coroutine_handle<promise_type> h;
+    };
+
+    // A step awaited by another coroutine, which it resumes when done.
+    template <class T>
+    struct Lazy {
+        struct promise_type {
+            std::optional<T> value;
+            std::coroutine_handle<> next;
+
+            Lazy get_return_object() { return Lazy{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept {
+                struct Resume {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                        return h.promise().next;
+                    }
+                    void await_resume() noexcept {}
+                };
+                return Resume{};
+            }
+            void return_value(T v) { value = std::move(v); }
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        std::coroutine_handle<promise_type> h;
+
+        explicit Lazy(std::coroutine_handle<promise_type> c) : h(c) {}
+        Lazy(Lazy&& o) noexcept : h(std::exchange(o.h, {})) {}
+        Lazy(const Lazy&) = delete;
+        ~Lazy() {
+            if (h) h.destroy();
+        }
+
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+            h.promise().next = caller;
+            return h;
+        }
+        T await_resume() { return std::move(*h.promise().value); }
+    };
+
+    // co_await perform(easy): the CURLcode the transfer ended with.
+    struct Transfer {
+        AsyncLoop& loop;
+        CURL* easy;
+        CURLcode res = CURLE_OK;
+        std::coroutine_handle<> waiter;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            waiter = h;
+            return loop.submit(this);
+        }
+        CURLcode await_resume() const noexcept { return res; }
+    };
+
+    struct Sleep {
+        AsyncLoop& loop;
+        Clock::time_point at;
+
+        bool await_ready() const { return at <= Clock::now(); }
+        void await_suspend(std::coroutine_handle<> h) { loop.timers.push({at, loop.timer_seq++, h}); }
+        void await_resume() const noexcept {}
+    };
+
+    // co_await park(fn): fn(wake) runs as the task suspends. If it returns
+    // true it has handed `wake` on, and the task stays parked until someone
+    // calls it, from any thread; if false the task goes straight on.
+    template <class F>
+    struct Park {
+        AsyncLoop& loop;
+        F fn;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            AsyncLoop* l = &loop;
+            return fn(std::function<void()>([l, h] { l->post(h); }));
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct Timer {
+        Clock::time_point at;
+        uint64_t seq;   // FIFO among equal deadlines
+        std::coroutine_handle<> h;
+
+        bool operator>(const Timer& o) const { return at != o.at ? at > o.at : seq > o.seq; }
+    };
+
+    size_t max_inflight = 1024;   // transfers on the multi handle; more wait in `backlog`
+    size_t live = 0;              // spawned tasks not yet finished
+
+    CURLM* multi = nullptr;
+    int ep = -1;
+    int tfd = -1;
+    int efd = -1;                 // post() from other threads wakes epoll_wait
+    std::optional<Clock::time_point> curl_due;   // libcurl's next timeout
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    uint64_t timer_seq = 0;
+    std::unordered_map<CURL*, Transfer*> active;
+    std::deque<Transfer*> backlog;
+    std::deque<std::coroutine_handle<>> ready;
+    std::mutex posted_mu;
+    std::vector<std::coroutine_handle<>> posted;   // resumed by the next run_once()
+
+    AsyncLoop() {
+        multi = curl_multi_init();
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!multi || ep < 0 || tfd < 0 || efd < 0) return;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = tfd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
+        ev.data.fd = efd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, on_socket);
+        curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, on_timer);
+        curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+    }
+    ~AsyncLoop() {
+        if (multi) curl_multi_cleanup(multi);
+        if (tfd >= 0) ::close(tfd);
+        if (efd >= 0) ::close(efd);
+        if (ep >= 0) ::close(ep);
+    }
+    AsyncLoop(const AsyncLoop&) = delete;
+    AsyncLoop& operator=(const AsyncLoop&) = delete;
+
+    bool ok() const { return multi && ep >= 0 && tfd >= 0 && efd >= 0; }
+
+    // Runs `t` up to its first suspension; the loop keeps it from there.
+    void spawn(Task t) {
+        t.h.promise().live = &live;
+        ++live;
+        t.h.resume();
+    }
+
+    Transfer perform(CURL* easy) { return Transfer{*this, easy, CURLE_OK, {}}; }
+    Sleep sleep_until(Clock::time_point at) { return Sleep{*this, at}; }
+    template <class F>
+    Park<F> park(F fn) { return Park<F>{*this, std::move(fn)}; }
+
+    // Queues `h` to be resumed on this loop; safe from any thread.
+    void post(std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock(posted_mu);
+            posted.push_back(h);
+        }
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t r = ::write(efd, &one, sizeof(one));
+    }
+
+    // Waits up to max_wait_ms for sockets or timers, then resumes every
+    // task whose transfer finished or whose sleep ran out.
+    void run_once(int max_wait_ms) {
+        arm_timer();
+        epoll_event evs[64];
+        int n = epoll_wait(ep, evs, 64, max_wait_ms);
+        int running = 0;
+        for (int i = 0; i < n; ++i) {
+            int fd = evs[i].data.fd;
+            if (fd == tfd || fd == efd) {
+                uint64_t count;
+                [[maybe_unused]] ssize_t r = ::read(fd, &count, sizeof(count));
+                continue;
+            }
+            int flags = 0;
+            if (evs[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+            if (evs[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if (evs[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(multi, fd, flags, &running);
+        }
+
+        auto now = Clock::now();
+        if (curl_due && *curl_due <= now) {
+            curl_due.reset();
+            curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        while (!timers.empty() && timers.top().at <= now) {
+            ready.push_back(timers.top().h);
+            timers.pop();
+        }
+        reap();
+        {
+            std::lock_guard<std::mutex> lock(posted_mu);
+            ready.insert(ready.end(), posted.begin(), posted.end());
+            posted.clear();
+        }
+        while (!ready.empty()) {
+            auto h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+    }
+
+private:
+    bool submit(Transfer* t) {
+        if (active.size() >= max_inflight) {
+            backlog.push_back(t);
+            return true;
+        }
+        return start(t);
+    }
+
+    // False (and res set) if the handle could not be added.
+    bool start(Transfer* t) {
+        if (curl_multi_add_handle(multi, t->easy) != CURLM_OK) {
+            t->res = CURLE_FAILED_INIT;
+            return false;
+        }
+        active.emplace(t->easy, t);
+        return true;
+    }
+
+    void reap() {
+        int left = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL* h = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(multi, h);
+            auto it = active.find(h);
+            if (it == active.end()) continue;
+            it->second->res = res;
+            ready.push_back(it->second->waiter);
+            active.erase(it);
+        }
+        while (!backlog.empty() && active.size() < max_inflight) {
+            Transfer* t = backlog.front();
+            backlog.pop_front();
+            if (!start(t)) ready.push_back(t->waiter);
+        }
+    }
+
+    void arm_timer() {
+        std::optional<Clock::time_point> at = curl_due;
+        if (!timers.empty() && (!at || timers.top().at < *at)) at = timers.top().at;
+        itimerspec its{};
+        if (at) {
+            long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(*at - Clock::now()).count();
+            ns = std::max(1LL, ns);   // 0 would disarm the timer
+            its.it_value.tv_sec = (time_t)(ns / 1000000000);
+            its.it_value.tv_nsec = (long)(ns % 1000000000);
+        }
+        timerfd_settime(tfd, 0, &its, nullptr);
+    }
+
+    static int on_socket(CURL*, curl_socket_t s, int what, void* userp, void*) {
+        auto* loop = static_cast<AsyncLoop*>(userp);
+        if (what == CURL_POLL_REMOVE) {
+            epoll_ctl(loop->ep, EPOLL_CTL_DEL, s, nullptr);
+            return 0;
+        }
+        epoll_event ev{};
+        if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+        if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+        ev.data.fd = s;
+        if (epoll_ctl(loop->ep, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+            epoll_ctl(loop->ep, EPOLL_CTL_ADD, s, &ev);
+        }
+        return 0;
+    }
+
+    static int on_timer(CURLM*, long timeout_ms, void* userp) {
+        auto* loop = static_cast<AsyncLoop*>(userp);
+        if (timeout_ms < 0) loop->curl_due.reset();
+        else loop->curl_due = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        return 0;
+    }
+};
+
+#else
+
+struct AsyncLoop;   // not in this build: --engine async is refused
+
+#endif // SPIDER_ASYNC
+
+/* ===================== Crawl frontier ===================== */
+
+struct CrawlItem {
+    std::string url;
+    int depth_left = 0;
+};
+
+// Open-addressing (linear probing) set of fingerprints; 0 marks an empty
+// slot. The table doubles at 0.7 load, so it sits between 0.35 and 0.7:
+// about 11 to 23 bytes per entry, against ~100 for a node of
+// unordered_set<std::string> holding a typical URL.
+struct FingerprintSet {
+    std::vector<uint64_t> slots;
+    size_t count = 0;
+
+    bool insert(uint64_t fp) {
+        if (fp == 0) fp = 1;
+        if ((count + 1) * 10 > slots.size() * 7) grow();
+        size_t mask = slots.size() - 1;
+        for (size_t i = fp & mask;; i = (i + 1) & mask) {
+            if (slots[i] == fp) return false;
+            if (slots[i] == 0) {
+                slots[i] = fp;
+                ++count;
+                return true;
+            }
+        }
+    }
+
+private:
+    void grow() {
+        std::vector<uint64_t> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 64 : old.size() * 2, 0);
+        size_t mask = slots.size() - 1;
+        for (uint64_t fp : old) {
+            if (fp == 0) continue;
+            size_t i = fp & mask;
+            while (slots[i] != 0) i = (i + 1) & mask;
+            slots[i] = fp;
+        }
+    }
+};
+
+// Set of URLs shared by all workers; sharded so inserts from different
+// threads rarely meet on the same lock. In compact mode only fingerprints
+// are kept (--compact-dedup), trading exactness for memory. The URLs
+// themselves are packed into each shard's arena, so looking up one that
+// is already known needs no copy of it.
+struct ConcurrentSet {
+    static constexpr size_t kShards = 64;
+    struct Shard {
+        std::mutex mu;
+        std::pmr::monotonic_buffer_resource strings;
+        std::unordered_set<std::string_view> items;
+        FingerprintSet prints;
+    };
+    Shard shards[kShards];
+    bool compact = false;   // set before the first insert
+
+    // true if `s` was not present before
+    bool insert(std::string_view s) {
+        uint64_t fp = url_fingerprint(s);
+        // top bits pick the shard, low bits the slot inside it
+        Shard& sh = shards[fp >> 58];
+        std::lock_guard<std::mutex> lock(sh.mu);
+        if (compact) return sh.prints.insert(fp);
+        if (sh.items.count(s)) return false;
+        char* copy = static_cast<char*>(sh.strings.allocate(std::max<size_t>(1, s.size()), 1));
+        std::memcpy(copy, s.data(), s.size());
+        sh.items.emplace(copy, s.size());
+        return true;
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (auto& sh : shards) {
+            std::lock_guard<std::mutex> lock(sh.mu);
+            n += compact ? sh.prints.count : sh.items.size();
+        }
+        return n;
+    }
+};
+
+// Overflow of the in-memory frontier (--frontier-mem). Items go to
+// numbered segment files as [depth:varint][len:varint][url] records and
+// come back oldest first; each segment is deleted once read, so disk use
+// tracks the backlog and memory stays at one segment being read.
+struct FrontierSpill {
+    static constexpr size_t kSegmentBytes = 4u << 20;
+
+    fs::path dir;
+    std::mutex mu;
+    std::atomic<size_t> count{0};   // items not yet handed back
+    uint64_t write_seg = 0;         // segment `out` appends to
+    uint64_t read_seg = 0;          // oldest segment still on disk
+    FILE* out = nullptr;
+    size_t out_bytes = 0;
+    std::deque<size_t> seg_items;   // items in each segment still on disk
+    std::string in;                 // segment being read back
+    size_t in_pos = 0;
+    size_t in_left = 0;             // items of `in` not yet handed back
+
+    FrontierSpill() = default;
+    FrontierSpill(const FrontierSpill&) = delete;
+    FrontierSpill& operator=(const FrontierSpill&) = delete;
+    ~FrontierSpill() { close(); }
+
+    bool open(const fs::path& d) {
+        dir = d;
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+        return fs::create_directories(dir, ec);
+    }
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+
+    bool push(const CrawlItem& item) {
+        char head[20];
+        size_t n = put_varint(head, (uint64_t)std::max(item.depth_left, 0));
+        n += put_varint(head + n, item.url.size());
+
+        std::lock_guard<std::mutex> lock(mu);
+        if (!out) {
+            out = std::fopen(segment(write_seg).c_str(), "wb");
+            if (!out) return false;
+            std::setvbuf(out, nullptr, _IOFBF, 1 << 16);
+            out_bytes = 0;
+            seg_items.push_back(0);
+        }
+        if (std::fwrite(head, 1, n, out) != n ||
+            std::fwrite(item.url.data(), 1, item.url.size(), out) != item.url.size()) {
+            // the torn record is not counted, so the reader stops before
+            // it; close the segment so nothing lands behind it
+            roll();
+            log_message("Frontier spill write failed, keeping the page in memory", LogLevel::Warn);
+            return false;
+        }
+        out_bytes += n + item.url.size();
+        ++seg_items.back();
+        if (out_bytes >= kSegmentBytes && !roll())
+            log_message("Frontier spill segment did not flush, some pages may be lost", LogLevel::Warn);
+        count.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves up to `max` of the oldest items into `batch`.
+    size_t pop_batch(std::vector<CrawlItem>& batch, size_t max) {
+        std::lock_guard<std::mutex> lock(mu);
+        size_t got = 0;
+        while (got < max && count.load(std::memory_order_relaxed) > 0) {
+            if (in_pos >= in.size() || in_left == 0) {
+                drop_rest();
+                if (seg_items.empty()) break;
+                load_next();
+                continue;
+            }
+            uint64_t depth = 0, len = 0;
+            if (!get_varint(in, in_pos, depth) || !get_varint(in, in_pos, len) || len > in.size() - in_pos) {
+                // short segment (failed write): drop the rest of it
+                drop_rest();
+                continue;
+            }
+            batch.push_back(CrawlItem{in.substr(in_pos, len), (int)depth});
+            in_pos += len;
+            --in_left;
+            count.fetch_sub(1, std::memory_order_release);
+            ++got;
+        }
+        return got;
+    }
+
+    void close() {
+        if (out) std::fclose(out);
+        out = nullptr;
+        if (!dir.empty()) {
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        }
+    }
+
+private:
+    fs::path segment(uint64_t n) const { return dir / ("seg-" + std::to_string(n)); }
+
+    // false if the segment did not reach the disk intact; the reader then
+    // finds it short and drops what is missing
+    bool roll() {
+        bool ok = std::fflush(out) == 0 && !std::ferror(out);
+        ok = std::fclose(out) == 0 && ok;
+        out = nullptr;
+        ++write_seg;
+        return ok;
+    }
+
+    // Gives up on what is left of the current segment, so a torn or
+    // unreadable one cannot hold `count` above zero for good.
+    void drop_rest() {
+        count.fetch_sub(in_left, std::memory_order_release);
+        in_left = 0;
+        in_pos = in.size();
+    }
+
+    // Only called while seg_items holds a segment.
+    void load_next() {
+        // catching up with the writer: close its segment to read it
+        if (read_seg == write_seg && !roll())
+            log_message("Frontier spill segment did not flush, some pages may be lost", LogLevel::Warn);
+        fs::path p = segment(read_seg++);
+        in_left = seg_items.front();
+        seg_items.pop_front();
+        in.clear();
+        in_pos = 0;
+        if (!read_file(p, in)) in.clear();
+        std::error_code ec;
+        fs::remove(p, ec);
+    }
+};
+
+// Scratch memory for one page: its body and every URL joined while it is
+// scanned. reset() drops all of it at once. If a page needed more than
+// the block, the block is regrown to fit it, so later pages of that size
+// neither malloc nor free.
+struct PageArena {
+    // Counts what the arena had to take beyond its block.
+    struct Overflow : std::pmr::memory_resource {
+        size_t bytes = 0;
+
+        void* do_allocate(size_t n, size_t align) override {
+            bytes += n;
+            return std::pmr::new_delete_resource()->allocate(n, align);
+        }
+        void do_deallocate(void* p, size_t n, size_t align) override {
+            std::pmr::new_delete_resource()->deallocate(p, n, align);
+        }
+        bool do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+    };
+
+    static constexpr size_t kInitial = 256 << 10;
+    std::unique_ptr<char[]> block;
+    size_t block_size = 0;
+    Overflow overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> res;
+
+    explicit PageArena(size_t initial = kInitial) { regrow(initial); }
+
+    std::pmr::memory_resource* get() { return &*res; }
+
+    void reset() {
+        if (overflow.bytes == 0) {
+            res->release();   // back to the start of the block
+            return;
+        }
+        size_t want = block_size;
+        while (want < block_size + overflow.bytes) want *= 2;
+        regrow(want);
+    }
+
+private:
+    void regrow(size_t n) {
+        res.reset();          // frees the overflow chunks
+        block.reset(new char[n]);
+        block_size = n;
+        overflow.bytes = 0;
+        res.emplace(block.get(), n, &overflow);
+    }
+};
+
+// Per-thread crawl state: its own slice of the frontier, its own multi
+// handle for image downloads and the arena its current page lives in.
+// With --engine async the thread runs an event loop instead, and its
+// pages and images are tasks on it; each page task brings its own arena
+// (see PageSlots), as several are in flight at once.
+struct CrawlWorker {
+    std::mutex mu;
+    std::deque<CrawlItem> queue;
+    DownloadEngine downloads;
+    PageArena arena;
+    AsyncLoop* loop = nullptr;
+};
+
+/* ===================== Checkpoint journal ===================== */
+
+// Append-only crawl log for resuming a killed run (--checkpoint FILE).
+// Layout: "SPJ1", then records of
+//
+//   [type:1][depth:varint][len:varint][url:len]
+//
+//   F  page claimed for the frontier (depth = depth_left)
+//   P  page finished: fetched, parsed, children already logged as F
+//   Q  image claimed for download
+//   I  image settled (downloaded or given up on)
+//
+// Replaying it restores visited_pages/downloaded_images and yields the
+// pages and images that were claimed but never finished. A torn record
+// at the tail (crash mid-write) is dropped.
+struct CrawlJournal {
+    enum : uint8_t { kPage = 'F', kPageDone = 'P', kImage = 'Q', kImageDone = 'I' };
+
+    struct Replay {
+        std::vector<std::string> pages;       // every claimed page
+        std::vector<std::string> images;      // every claimed image
+        std::vector<CrawlItem> frontier;      // claimed, not finished
+        std::vector<std::string> unsettled;   // images claimed, not settled
+        bool empty() const { return pages.empty() && images.empty(); }
+    };
+
+    std::mutex mu;
+    FILE* f = nullptr;
+
+    CrawlJournal() = default;
+    ~CrawlJournal() { if (f) std::fclose(f); }
+    CrawlJournal(const CrawlJournal&) = delete;
+    CrawlJournal& operator=(const CrawlJournal&) = delete;
+
+    // Loads whatever `path` already holds into `out`, then opens it for
+    // appending. False if the file exists but is not a journal.
+    bool open(const fs::path& path, Replay& out) {
+        std::string data;
+        {
+            std::ifstream in(path, std::ios::binary);
+            if (in) data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        size_t good = 0;
+        if (!data.empty()) {
+            if (data.compare(0, 4, "SPJ1") != 0) return false;
+            good = replay(data, out);
+        }
+
+        if (good == 0) {
+            f = std::fopen(path.c_str(), "wb");
+            if (!f) return false;
+            std::fwrite("SPJ1", 1, 4, f);
+        } else {
+            // cut a torn tail so new records follow the last complete one
+            fs::resize_file(path, good);
+            f = std::fopen(path.c_str(), "ab");
+            if (!f) return false;
+        }
+        std::setvbuf(f, nullptr, _IOFBF, 1 << 16);
+        return true;
+    }
+
+    void record(uint8_t type, std::string_view url, int depth = 0) {
+        char buf[1 + 2 * 10];
+        size_t n = 0;
+        buf[n++] = (char)type;
+        n += put_varint(buf + n, (uint64_t)std::max(depth, 0));
+        n += put_varint(buf + n, url.size());
+        std::lock_guard<std::mutex> lock(mu);
+        if (!f) return;
+        std::fwrite(buf, 1, n, f);
+        std::fwrite(url.data(), 1, url.size(), f);
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mu);
+        if (f) std::fflush(f);
+    }
+
+private:
+    // Returns the offset just past the last complete record.
+    static size_t replay(std::string_view d, Replay& out) {
+        std::unordered_map<std::string, size_t> open_pages, open_images;
+        size_t i = 4, good = 4;
+        while (i < d.size()) {
+            size_t start = i;
+            uint8_t type = (uint8_t)d[i++];
+            uint64_t depth = 0, len = 0;
+            if (!get_varint(d, i, depth) || !get_varint(d, i, len)) break;
+            if (len > d.size() - i) break;
+            std::string url(d.substr(i, len));
+            i += len;
+            good = i;
+
+            switch (type) {
+            case kPage:
+                open_pages.emplace(url, out.frontier.size());
+                out.frontier.push_back(CrawlItem{url, (int)depth});
+                out.pages.push_back(std::move(url));
+                break;
+            case kPageDone: {
+                auto it = open_pages.find(url);
+                if (it != open_pages.end()) {
+                    out.frontier[it->second].depth_left = -1;
+                    open_pages.erase(it);
+                }
+                break;
+            }
+            case kImage:
+                open_images.emplace(url, out.unsettled.size());
+                out.unsettled.push_back(url);
+                out.images.push_back(std::move(url));
+                break;
+            case kImageDone: {
+                auto it = open_images.find(url);
+                if (it != open_images.end()) {
+                    out.unsettled[it->second].clear();
+                    open_images.erase(it);
+                }
+                break;
+            }
+            default:
+                good = start;   // unknown record: keep what came before it
+                break;
+            }
+            if (good == start) break;
+        }
+
+        auto& fr = out.frontier;
+        fr.erase(std::remove_if(fr.begin(), fr.end(),
+                                [](const CrawlItem& c) { return c.depth_left < 0; }), fr.end());
+        auto& un = out.unsettled;
+        un.erase(std::remove_if(un.begin(), un.end(),
+                                [](const std::string& u) { return u.empty(); }), un.end());
+        return good;
+    }
+};
+
+/* ===================== Spider core ===================== */
+
+struct Options {
+    bool recursive = false;
+    int max_depth = 0;          // used only if recursive
+    fs::path out_dir = "./data";
+    int jobs = 8;               // concurrent image downloads (-j)
+    bool stream = false;        // parse pages while they download (--stream)
+    int threads = 1;            // crawl worker threads (-t)
+    bool compact_dedup = false; // fingerprint-only dedup sets (--compact-dedup)
+    int host_conns = 8;         // parallel requests per host, 0 = unlimited (--host-conns)
+    double host_rps = 0;        // requests per second per host, 0 = unlimited (--host-rps)
+    bool robots = false;        // honour robots.txt (--robots)
+    fs::path checkpoint;        // resumable crawl journal (--checkpoint), empty = off
+    fs::path cache_dir;         // ETag/Last-Modified cache (--cache), empty = off
+    bool cas = false;           // content-addressed image store (--cas)
+    bool direct_io = false;     // write images with O_DIRECT (--direct-io)
+    bool sniff = true;          // refuse non-image bodies early (--no-sniff)
+    long long max_size = 0;     // per-image byte cap (--max-size), 0 = none
+    double stats_interval = 0;  // seconds between [STATS] lines, 0 = off
+    std::string stats_json;     // telemetry dump at the end ("-" = stdout)
+    LogLevel log_level = LogLevel::Info;
+    bool log_json = false;      // NDJSON log records (--log-json)
+    size_t frontier_mem = 0;    // pages kept in memory before spilling (--frontier-mem)
+    fs::path meta_out;          // NDJSON metadata of every image (--meta), empty = off
+    std::string meta_fields;    // --meta-fields LIST, empty = everything
+    int meta_jobs = 0;          // extractor threads (--meta-jobs), 0 = number of cores
+    bool meta_only = false;     // extract but do not keep images (--meta-only)
+    long long meta_range = 0;   // fetch metadata prefixes only, first N bytes (--meta-range)
+    bool async_engine = false;  // event loop + coroutines per thread (--engine async)
+    size_t inflight = 1024;     // --engine async: transfers (and pages) in flight per thread
+};
+
+// Breadth-first crawl over a frontier of (url, depth) items. Each worker
+// takes from the front of its own queue and, when that runs dry, steals
+// the older half of another worker's queue. Pages are claimed in
+// visited_pages when they are discovered, so every URL is queued once,
+// at the shallowest depth it was found.
+struct Spider {
+    Options opt;
+    std::string user_agent = "Mozilla/5.0 (X11; Linux x86_64) ArachnidaSpider/1.0";
+
+    ConcurrentSet visited_pages;
+    ConcurrentSet downloaded_images;
+
+    // pool and scheduler outlive the workers: members are destroyed in
+    // reverse order
+    CurlPool pool;
+    HttpCache cache;
+    ContentStore cas;
+    Telemetry stats;
+    MetaPipeline pipeline;
+    FetchContext fetch;
+    HostScheduler hosts;
+    CrawlJournal journal;
+    bool journaling = false;
+    std::vector<std::unique_ptr<CrawlWorker>> workers;
+    FrontierSpill spill;
+    size_t queue_cap = 0;       // per-worker in-memory frontier, 0 = unbounded
+
+    // queued (in memory or spilled) + in-progress pages; the crawl ends when it drops to zero
+    std::atomic<long> pending{0};
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+
+    // False only if the checkpoint journal cannot be used.
+    bool crawl(const std::string& url, int depth_left) {
+        if (url.empty() || !parse_url(url)) return true;
+
+        visited_pages.compact = opt.compact_dedup;
+        downloaded_images.compact = opt.compact_dedup;
+        hosts.max_conns = opt.host_conns;
+        hosts.rps = opt.host_rps;
+        hosts.agent = robots_token(user_agent);
+
+        fetch.user_agent = user_agent;
+        fetch.pool = &pool;
+        if (!opt.cache_dir.empty()) {
+            if (!cache.load(opt.cache_dir)) {
+                std::cerr << "Cannot use cache directory: " << opt.cache_dir << "\n";
+                return false;
+            }
+            fetch.cache = &cache;
+        }
+        if (opt.cas) {
+            if (!cas.open(opt.out_dir)) {
+                std::cerr << "Cannot set up content store in: " << opt.out_dir << "\n";
+                return false;
+            }
+            fetch.cas = &cas;
+        }
+        fetch.direct_io = opt.direct_io;
+        fetch.sniff = opt.sniff;
+        fetch.max_size = opt.max_size;
+        fetch.stats = &stats;
+
+        int n = std::max(1, opt.threads);
+        workers.clear();
+        for (int i = 0; i < n; ++i) {
+            auto w = std::make_unique<CrawlWorker>();
+            w->downloads.max_parallel = opt.jobs;
+            w->downloads.ctx = &fetch;
+            w->downloads.hosts = &hosts;
+            if (opt.robots) {
+                w->downloads.admit = [this](const Download& d) {
+                    auto u = parse_url(d.url);
+                    return u && robots_allowed(*u);
+                };
+            }
+            if (journaling) {
+                w->downloads.on_done = [this](const Download& d, bool) {
+                    journal.record(CrawlJournal::kImageDone, d.url);
+                };
+            }
+            workers.push_back(std::move(w));
+        }
+        if (opt.frontier_mem > 0) {
+            if (!spill.open(opt.out_dir / ".frontier")) {
+                std::cerr << "Cannot create frontier spill directory in: " << opt.out_dir << "\n";
+                return false;
+            }
+            queue_cap = std::max<size_t>(1, opt.frontier_mem / workers.size());
+        }
+
+        CrawlJournal::Replay replay;
+        if (journaling && !journal.open(opt.checkpoint, replay)) {
+            std::cerr << "Cannot use checkpoint file: " << opt.checkpoint << "\n";
+            return false;
+        }
+
+        // last, as its threads are running from here on
+        if (!opt.meta_out.empty()) {
+            pipeline.save_images = !opt.meta_only;
+            int jobs = opt.meta_jobs > 0 ? opt.meta_jobs : (int)std::max(1u, std::thread::hardware_concurrency());
+            if (!pipeline.start(opt.meta_out, opt.meta_fields, jobs)) {
+                std::cerr << "Cannot write metadata file: " << opt.meta_out << "\n";
+                return false;
             }
-        } else {
-            tmp.push_back(c);
+            fetch.pipeline = &pipeline;
+            fetch.meta_range = opt.meta_range;
         }
-    }
-    if (!tmp.empty()) parts.push_back(tmp);
 
-    std::vector<std::string> norm;
-    for (auto &seg : parts) {
-        if (seg == "." || seg.empty()) continue;
-        if (seg == "..") {
-            if (!norm.empty()) norm.pop_back();
-            continue;
+        bool resumed = false;
+        if (!replay.empty()) {
+            resume(replay);
+            resumed = true;
         }
-        norm.push_back(seg);
-    }
+        if (!resumed) claim_page(*workers[0], url, depth_left);
 
-    std::string out = "/";
-    for (size_t i = 0; i < norm.size(); ++i) {
-        out += norm[i];
-        if (i + 1 < norm.size()) out += "/";
+        StatsReporter reporter;
+        if (opt.stats_interval > 0) reporter.start(stats, opt.stats_interval);
+
+        std::vector<std::thread> threads;
+        for (int i = 1; i < n; ++i) threads.emplace_back([this, i] { run_worker(i); });
+        run_worker(0);
+        for (auto& t : threads) t.join();
+        workers.clear();
+        spill.close();
+        if (fetch.pipeline) {
+            pipeline.stop();
+            log_message("Metadata: " + std::to_string(pipeline.records.load()) + " records -> " +
+                        opt.meta_out.string());
+        }
+        reporter.stop();
+        if (journaling) journal.flush();
+        if (fetch.cache) cache.save();
+        return write_stats();
     }
 
-    return base.scheme + "://" + base.host + out;
-}
+private:
+    bool write_stats() {
+        if (opt.stats_json.empty()) return true;
+        if (opt.stats_json == "-") {
+            stats.write_json(std::cout);
+            return true;
+        }
+        std::ofstream out(opt.stats_json, std::ios::trunc);
+        stats.write_json(out);
+        if (!out) {
+            std::cerr << "Cannot write stats to: " << opt.stats_json << "\n";
+            return false;
+        }
+        return true;
+    }
 
-/* ===================== HTML extraction ===================== */
+    // Restores the dedup sets from a journal and hands its unfinished
+    // pages and images back to the workers, round-robin.
+    void resume(const CrawlJournal::Replay& r) {
+        for (const auto& u : r.pages) visited_pages.insert(u);
+        for (const auto& u : r.images) downloaded_images.insert(u);
+        log_message("[RESUME] " + std::to_string(r.frontier.size()) + " pages, " +
+                    std::to_string(r.unsettled.size()) + " images left from checkpoint");
 
-static std::vector<std::string> extract_attr_urls(const std::string& html, const std::string& attrName) {
-    // Find attrName= "..." or '...' or unquoted
-    // This is not a full HTML parser, but good enough for many pages.
-    std::vector<std::string> out;
-    std::string an = attrName;
-
-    // Regex: attrName\s*=\s*("...")|('...')|([^\s>]+)
-    // We'll search across entire HTML.
-    std::regex re(
-        an + "\\s*=\\s*(\"([^\"]*)\"|'([^']*)'|([^\\s>]+))",
-        std::regex::icase
-    );
-
-    auto begin = std::sregex_iterator(html.begin(), html.end(), re);
-    auto end = std::sregex_iterator();
-    for (auto it = begin; it != end; ++it) {
-        std::smatch m = *it;
-        std::string v;
-        if (m[2].matched) v = m[2].str();
-        else if (m[3].matched) v = m[3].str();
-        else if (m[4].matched) v = m[4].str();
-        v = trim(v);
-        if (!v.empty()) out.push_back(v);
+        size_t k = 0;
+        for (const auto& item : r.frontier) push(*workers[k++ % workers.size()], item);
+        for (const auto& u : r.unsettled) {
+            auto parts = parse_url(u);
+            if (!parts) continue;
+            workers[k++ % workers.size()]->downloads.add(u, parts->host(), image_path(u));
+        }
     }
-    return out;
-}
 
-static std::vector<std::string> extract_img_srcs(const std::string& html) {
-    // We only want src in <img ...> tags. We'll do a quick pass:
-    std::vector<std::string> out;
-    std::regex imgTag(R"(<\s*img\b[^>]*>)", std::regex::icase);
-    auto begin = std::sregex_iterator(html.begin(), html.end(), imgTag);
-    auto end = std::sregex_iterator();
-    for (auto it = begin; it != end; ++it) {
-        std::string tag = (*it).str();
-        auto srcs = extract_attr_urls(tag, "src");
-        for (auto &s : srcs) out.push_back(s);
+    // Where an image goes; with --cas the final name is only known once the
+    // body is hashed, so this is the object stored last time (or empty).
+    fs::path image_path(const std::string& url) {
+        if (opt.cas) return cas.lookup(url);
+        return opt.out_dir / filename_from_url(url);
     }
-    return out;
-}
 
-static std::vector<std::string> extract_a_hrefs(const std::string& html) {
-    std::vector<std::string> out;
-    std::regex aTag(R"(<\s*a\b[^>]*>)", std::regex::icase);
-    auto begin = std::sregex_iterator(html.begin(), html.end(), aTag);
-    auto end = std::sregex_iterator();
-    for (auto it = begin; it != end; ++it) {
-        std::string tag = (*it).str();
-        auto hrefs = extract_attr_urls(tag, "href");
-        for (auto &h : hrefs) out.push_back(h);
+    void claim_page(CrawlWorker& w, std::string_view url, int depth_left) {
+        if (!visited_pages.insert(url)) return;
+        if (journaling) journal.record(CrawlJournal::kPage, url, depth_left);
+        push(w, CrawlItem{std::string(url), depth_left});
     }
-    return out;
-}
-
-/* ===================== Image filters ===================== */
 
-static bool is_image_url(const std::string& url) {
-    std::string u = to_lower(url);
-    // strip query/fragment for extension check
-    auto cut = u.find_first_of("?#");
-    if (cut != std::string::npos) u = u.substr(0, cut);
+    void push(CrawlWorker& w, CrawlItem item) {
+        ++pending;
+        bool to_disk = false;
+        {
+            std::lock_guard<std::mutex> lock(w.mu);
+            // while anything is on disk, newer items queue up behind it
+            if (queue_cap && (w.queue.size() >= queue_cap || spill.size() > 0)) to_disk = true;
+            else w.queue.push_back(std::move(item));
+        }
+        if (to_disk && !spill.push(item)) {
+            // disk full or gone: better over budget than dropping pages
+            std::lock_guard<std::mutex> lock(w.mu);
+            w.queue.push_back(std::move(item));
+        }
+        idle_cv.notify_one();
+    }
 
-    static const std::vector<std::string> exts = {
-        ".jpg", ".jpeg", ".png", ".gif", ".bmp"
-    };
+    // Takes the next items off disk once memory has drained.
+    bool refill(CrawlWorker& w, CrawlItem& out) {
+        if (!queue_cap || spill.size() == 0) return false;
+        std::vector<CrawlItem> batch;
+        if (spill.pop_batch(batch, std::max<size_t>(1, queue_cap / 2)) == 0) return false;
+        out = std::move(batch.front());
+        std::lock_guard<std::mutex> lock(w.mu);
+        for (size_t j = 1; j < batch.size(); ++j) w.queue.push_back(std::move(batch[j]));
+        return true;
+    }
 
-    for (auto &e : exts) {
-        if (u.size() >= e.size() && u.compare(u.size() - e.size(), e.size(), e) == 0)
-            return true;
+    bool pop(CrawlWorker& w, CrawlItem& out) {
+        std::lock_guard<std::mutex> lock(w.mu);
+        if (w.queue.empty()) return false;
+        out = std::move(w.queue.front());
+        w.queue.pop_front();
+        return true;
     }
-    return false;
-}
 
-static std::string filename_from_url(const std::string& url) {
-    std::string u = url;
-    auto cut = u.find_first_of("?#");
-    if (cut != std::string::npos) u = u.substr(0, cut);
+    bool steal(size_t self, CrawlItem& out) {
+        for (size_t k = 1; k < workers.size(); ++k) {
+            CrawlWorker& victim = *workers[(self + k) % workers.size()];
+            std::vector<CrawlItem> batch;
+            {
+                std::lock_guard<std::mutex> lock(victim.mu);
+                size_t take = (victim.queue.size() + 1) / 2;
+                for (size_t j = 0; j < take; ++j) {
+                    batch.push_back(std::move(victim.queue.front()));
+                    victim.queue.pop_front();
+                }
+            }
+            if (batch.empty()) continue;
 
-    auto slash = u.find_last_of('/');
-    if (slash == std::string::npos || slash + 1 >= u.size()) {
-        // fallback
-        return "image.bin";
+            out = std::move(batch.front());
+            CrawlWorker& me = *workers[self];
+            std::lock_guard<std::mutex> lock(me.mu);
+            for (size_t j = 1; j < batch.size(); ++j) me.queue.push_back(std::move(batch[j]));
+            return true;
+        }
+        return false;
     }
-    std::string name = u.substr(slash + 1);
-    if (name.empty()) name = "image.bin";
 
-    // avoid weird characters in filenames
-    for (char& c : name) {
-        if (!(std::isalnum((unsigned char)c) || c == '.' || c == '_' || c == '-' )) {
-            c = '_';
+    void run_worker(size_t self) {
+#ifdef SPIDER_ASYNC
+        if (opt.async_engine) {
+            work_async(self);
+            return;
         }
+#endif
+        work(self);
     }
-    return name;
-}
-
-/* ===================== libcurl helpers ===================== */
-
-static size_t write_to_string(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t total = size * nmemb;
-    auto* s = static_cast<std::string*>(userp);
-    s->append(static_cast<char*>(contents), total);
-    return total;
-}
-
-static size_t write_to_file(void* contents, size_t size, size_t nmemb, void* userp) {
-    size_t total = size * nmemb;
-    auto* ofs = static_cast<std::ofstream*>(userp);
-    ofs->write(static_cast<char*>(contents), total);
-    return total;
-}
 
-static bool http_get_text(const std::string& url, std::string& out, const std::string& user_agent) {
-    CURL* curl = curl_easy_init();
-    if (!curl) return false;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 15L);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_string);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+    void work(size_t self) {
+        CrawlWorker& w = *workers[self];
+        for (;;) {
+            CrawlItem item;
+            if (pop(w, item) || steal(self, item) || refill(w, item)) {
+                process(w, item);
+                if (--pending == 0) idle_cv.notify_all();
+                continue;
+            }
+            if (pending.load() == 0) break;
 
-    CURLcode res = curl_easy_perform(curl);
+            // frontier is momentarily empty: keep our downloads moving
+            // while other workers finish the pages that may feed us
+            if (!w.downloads.idle()) {
+                w.downloads.poll(20);
+            } else {
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                idle_cv.wait_for(lock, std::chrono::milliseconds(20));
+            }
+        }
+        w.downloads.run(true);
+    }
 
-    long code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-    curl_easy_cleanup(curl);
+    bool robots_allowed(const UrlParts& u) {
+        return hosts.robots_allowed(u, [this](const std::string& robots_url, std::string& body) {
+            return http_get_text(robots_url, body, fetch);
+        });
+    }
 
-    return (res == CURLE_OK && code >= 200 && code < 300);
-}
+    // Blocks until the scheduler grants a slot for `host`, keeping this
+    // worker's own downloads moving meanwhile (they may be what holds it).
+    void acquire_host(CrawlWorker& w, std::string_view host) {
+        for (;;) {
+            HostScheduler::Clock::time_point retry_at;
+            if (hosts.try_acquire(host, retry_at)) return;
+            if (!w.downloads.idle()) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    retry_at - HostScheduler::Clock::now()).count();
+                w.downloads.poll((int)std::max<long long>(1, ms));
+            } else {
+                std::this_thread::sleep_until(retry_at);
+            }
+        }
+    }
 
-static bool http_download_file(const std::string& url, const fs::path& out_path, const std::string& user_agent) {
-    fs::create_directories(out_path.parent_path());
+    // `joined` is the page's join buffer (in its arena): only an image not
+    // seen before is copied out of it.
+    void add_image(CrawlWorker& w, const UrlParts& base, std::string_view src, std::pmr::string& joined) {
+        join_url_to(base, src, joined);
+        if (joined.empty()) return;
+        if (!is_image_url(joined)) return;
+        size_t scheme_len, host_end;
+        if (!split_url(trim_view(joined), scheme_len, host_end)) return;
 
-    std::ofstream ofs(out_path, std::ios::binary);
-    if (!ofs) return false;
+        if (!downloaded_images.insert(joined)) return;
+        std::string imgUrl(joined);
+        auto imgParts = parse_url(imgUrl);   // cannot fail once split_url() has passed
+        if (journaling) journal.record(CrawlJournal::kImage, imgUrl);
 
-    CURL* curl = curl_easy_init();
-    if (!curl) return false;
+        fs::path out_path = image_path(imgUrl);
+#ifdef SPIDER_ASYNC
+        if (w.loop) {
+            auto d = std::make_unique<Download>();
+            d->url = std::move(imgUrl);
+            d->host = HostScheduler::key(imgParts->host());
+            d->out_path = std::move(out_path);
+            w.loop->spawn(image_task(*w.loop, std::move(d)));
+            return;
+        }
+#endif
+        // a streamed page is still inside a curl callback: always queue
+        if (opt.jobs <= 1 && !opt.stream) {
+            if (opt.robots && !robots_allowed(*imgParts)) {
+                log_event(LogLevel::Info, LogEvent::Disallowed, imgUrl);
+            } else {
+                acquire_host(w, imgParts->host());
+                Download d;
+                d.url = imgUrl;
+                d.out_path = out_path;
+                log_download(d, http_download_file(d, fetch));
+                hosts.release(imgParts->host());
+            }
+            if (journaling) journal.record(CrawlJournal::kImageDone, imgUrl);
+        } else {
+            w.downloads.add(imgUrl, imgParts->host(), out_path);
+        }
+    }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_file);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ofs);
+    void add_link(CrawlWorker& w, const UrlParts& base, int depth_left, std::string_view href,
+                  std::pmr::string& joined) {
+        join_url_to(base, href, joined);
+        std::string_view nv = trim_view(joined);
+        size_t scheme_len, host_end;
+        if (!split_url(nv, scheme_len, host_end)) return;
 
-    CURLcode res = curl_easy_perform(curl);
+        // Optional: stay on same host to avoid crawling entire web
+        if (!same_host(nv.substr(scheme_len + 3, host_end - scheme_len - 3), base)) return;
 
-    long code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-    curl_easy_cleanup(curl);
-    ofs.close();
+        // the frontier keys pages the way parse_url() stores them
+        char* p = &joined[(size_t)(nv.data() - joined.data())];
+        for (size_t i = 0; i < scheme_len; ++i) p[i] = (char)std::tolower((unsigned char)p[i]);
+        claim_page(w, nv, depth_left - 1);
+    }
 
-    if (!(res == CURLE_OK && code >= 200 && code < 300)) {
-        // cleanup partial file
-        std::error_code ec;
-        fs::remove(out_path, ec);
-        return false;
+    // One reference found on a page `depth_left` levels above the limit.
+    void add_ref(CrawlWorker& w, const UrlParts& base, int depth_left, HtmlRef kind, std::string_view v,
+                 std::pmr::string& joined) {
+        if (kind == HtmlRef::Image) add_image(w, base, v, joined);
+        else if (opt.recursive && depth_left > 0) add_link(w, base, depth_left, v, joined);   // follow links if enabled
     }
-    return true;
-}
 
-/* ===================== Spider core ===================== */
+    void process(CrawlWorker& w, const CrawlItem& item) {
+        fetch_page(w, item);
+        if (journaling) {
+            journal.record(CrawlJournal::kPageDone, item.url);
+            journal.flush();
+        }
+    }
 
-struct Options {
-    bool recursive = false;
-    int max_depth = 0;          // used only if recursive
-    fs::path out_dir = "./data";
-};
+    void fetch_page(CrawlWorker& w, const CrawlItem& item) {
+        // nothing from the previous page is alive any more
+        w.arena.reset();
+        const std::string& url = item.url;
+        auto partsOpt = parse_url(url);
+        if (!partsOpt) return;
 
-struct Spider {
-    Options opt;
-    std::string user_agent = "Mozilla/5.0 (X11; Linux x86_64) ArachnidaSpider/1.0";
+        log_event(LogLevel::Info, LogEvent::Page, url, std::to_string(item.depth_left));
 
-    std::unordered_set<std::string> visited_pages;
-    std::unordered_set<std::string> downloaded_images;
+        if (opt.robots && !robots_allowed(*partsOpt)) {
+            log_event(LogLevel::Info, LogEvent::Disallowed, url);
+            return;
+        }
 
-    void crawl(const std::string& url, int depth_left) {
-        if (url.empty()) return;
+        // every reference is joined into this one buffer, so after the
+        // first few its capacity suffices and joining allocates nothing
+        std::pmr::string next(w.arena.get());
+        auto on_ref = [&](HtmlRef kind, std::string_view v) {
+            add_ref(w, *partsOpt, item.depth_left, kind, v, next);
+        };
 
-        auto partsOpt = parse_url(url);
-        if (!partsOpt) return;
+        bool ok = false;
+        // the page's host slot is held only while its body is in flight;
+        // serial image downloads below need slots of their own
+        acquire_host(w, partsOpt->host());
+        if (opt.stream) {
+            PageStream ps;
+            ps.emit = on_ref;
+            ok = w.downloads.stream_page(url, ps);
+            hosts.release(partsOpt->host());
+        } else {
+            std::pmr::string html(w.arena.get());
+            ok = http_get_text(url, html, fetch);
+            hosts.release(partsOpt->host());
+            if (ok) {
+                uint64_t ns = 0;
+                {
+                    ScopedTimer timer(ns);
+                    scan_html(html, on_ref);
+                }
+                stats.extract.record(ns / 1000);
+            }
+        }
+        (ok ? stats.pages : stats.pages_failed).fetch_add(1, std::memory_order_relaxed);
+        if (!ok) log_event(LogLevel::Warn, LogEvent::PageFailed, url);
+        w.downloads.run(false);
+    }
 
-        // avoid revisiting
-        if (visited_pages.find(url) != visited_pages.end()) return;
-        visited_pages.insert(url);
+#ifdef SPIDER_ASYNC
+    // --engine async: the thread runs an event loop. Pages still come off
+    // the frontier as in work() (own queue, steal, spill), but each one
+    // becomes a task, up to opt.inflight at a time, and so does every
+    // image they find.
+    // The pages in flight on one loop. Each holds an arena of its own;
+    // a finished page leaves it in `spare` for the next one to reset.
+    struct PageSlots {
+        static constexpr size_t kArena = 64 << 10;   // regrows like any arena
+        size_t running = 0;
+        std::vector<std::unique_ptr<PageArena>> spare;
 
-        std::string html;
-        std::cerr << "[PAGE] " << url << " (depth_left=" << depth_left << ")\n";
+        std::unique_ptr<PageArena> take() {
+            if (spare.empty()) return std::make_unique<PageArena>(kArena);
+            auto a = std::move(spare.back());
+            spare.pop_back();
+            return a;
+        }
+    };
 
-        if (!http_get_text(url, html, user_agent)) {
-            std::cerr << "  !! failed to fetch\n";
+    void work_async(size_t self) {
+        CrawlWorker& w = *workers[self];
+        AsyncLoop loop;
+        if (!loop.ok()) {
+            log_message("Cannot set up an event loop, using the threaded engine", LogLevel::Warn);
+            work(self);
             return;
         }
+        loop.max_inflight = opt.inflight;
+        w.loop = &loop;
+        for (auto& d : w.downloads.take_queued()) loop.spawn(image_task(loop, std::move(d)));
 
-        // Extract and download images
-        auto srcs = extract_img_srcs(html);
-        for (auto &src : srcs) {
-            std::string imgUrl = join_url(*partsOpt, src);
-            if (imgUrl.empty()) continue;
-            if (!is_image_url(imgUrl)) continue;
-
-            if (downloaded_images.find(imgUrl) != downloaded_images.end()) continue;
-            downloaded_images.insert(imgUrl);
+        PageSlots slots;
+        for (;;) {
+            CrawlItem item;
+            while (slots.running < opt.inflight && (pop(w, item) || steal(self, item) || refill(w, item))) {
+                ++slots.running;
+                loop.spawn(page_task(loop, w, std::move(item), slots, slots.take()));
+            }
+            if (loop.live == 0 && pending.load() == 0) break;
+            // short waits: other threads may queue pages for us to steal
+            loop.run_once(20);
+        }
+        w.loop = nullptr;
+    }
 
-            fs::path out_path = opt.out_dir / filename_from_url(imgUrl);
-            bool ok = http_download_file(imgUrl, out_path, user_agent);
-            if (ok) {
-                std::cerr << "  [IMG] " << imgUrl << " -> " << out_path.string() << "\n";
+    // Fetch page -> extract -> schedule images -> schedule links.
+    AsyncLoop::Task page_task(AsyncLoop& loop, CrawlWorker& w, CrawlItem item, PageSlots& slots,
+                              std::unique_ptr<PageArena> arena) {
+        // nothing from the arena's previous page is alive any more
+        arena->reset();
+        auto parts = parse_url(item.url);
+        if (parts) {
+            log_event(LogLevel::Info, LogEvent::Page, item.url, std::to_string(item.depth_left));
+            bool allowed = true;
+            if (opt.robots) allowed = co_await robots_async(loop, *parts);
+            if (!allowed) {
+                log_event(LogLevel::Info, LogEvent::Disallowed, item.url);
             } else {
-                std::cerr << "  !! failed img: " << imgUrl << "\n";
+                co_await host_slot(loop, parts->host());
+                std::pmr::string html(arena->get());
+                PageRequest<std::pmr::string> req(item.url, html, fetch);
+                bool ok = false;
+                if (req.begin()) ok = req.finish(co_await loop.perform(req.curl));
+                hosts.release(parts->host());
+
+                if (ok) {
+                    std::pmr::string joined(arena->get());
+                    uint64_t ns = 0;
+                    {
+                        ScopedTimer timer(ns);
+                        scan_html(html, [&](HtmlRef kind, std::string_view v) {
+                            add_ref(w, *parts, item.depth_left, kind, v, joined);
+                        });
+                    }
+                    stats.extract.record(ns / 1000);
+                }
+                (ok ? stats.pages : stats.pages_failed).fetch_add(1, std::memory_order_relaxed);
+                if (!ok) log_event(LogLevel::Warn, LogEvent::PageFailed, item.url);
             }
         }
+        if (journaling) {
+            journal.record(CrawlJournal::kPageDone, item.url);
+            journal.flush();
+        }
+        slots.spare.push_back(std::move(arena));
+        --slots.running;
+        if (--pending == 0) idle_cv.notify_all();
+    }
 
-        // Recurse into links if enabled
-        if (!opt.recursive) return;
-        if (depth_left <= 0) return;
-
-        auto hrefs = extract_a_hrefs(html);
-        for (auto &href : hrefs) {
-            std::string nextUrl = join_url(*partsOpt, href);
-            if (nextUrl.empty()) continue;
+    AsyncLoop::Task image_task(AsyncLoop& loop, std::unique_ptr<Download> d) {
+        bool allowed = true;
+        if (opt.robots) {
+            auto parts = parse_url(d->url);
+            allowed = parts && co_await robots_async(loop, *parts);
+        }
+        if (!allowed) {
+            log_event(LogLevel::Info, LogEvent::Disallowed, d->url);
+        } else {
+            co_await host_slot(loop, d->host);
+            bool ok = false;
+            do {
+                if (!download_begin(*d, fetch)) break;
+                CURLcode res = co_await loop.perform(d->curl);
+                ok = download_end(*d, res, fetch);
+            } while (d->again);   // next range, same host slot
+            hosts.release(d->host);
+            log_download(*d, ok);
+        }
+        if (journaling) journal.record(CrawlJournal::kImageDone, d->url);
+    }
 
-            // Optional: stay on same host to avoid crawling entire web
-            auto nextParts = parse_url(nextUrl);
-            if (!nextParts) continue;
-            if (to_lower(nextParts->host) != to_lower(partsOpt->host)) continue;
+    // Waits on the loop rather than the thread for a request slot: parked
+    // until release() frees one if the host is full, asleep until its next
+    // start time if it is rate limited.
+    AsyncLoop::Lazy<bool> host_slot(AsyncLoop& loop, std::string_view host) {
+        using Clock = HostScheduler::Clock;
+        for (;;) {
+            Clock::time_point retry_at{};
+            bool got = false;
+            co_await loop.park([&](std::function<void()> wake) {
+                got = hosts.try_acquire(host, retry_at, std::move(wake));
+                return !got && retry_at == Clock::time_point::max();
+            });
+            if (got) break;
+            if (retry_at != Clock::time_point::max()) co_await loop.sleep_until(retry_at);
+        }
+        co_return true;
+    }
 
-            crawl(nextUrl, depth_left - 1);
+    // robots_allowed() for tasks: the first one per host fetches the file
+    // on the loop, the rest are parked until robots_done() wakes them.
+    AsyncLoop::Lazy<bool> robots_async(AsyncLoop& loop, const UrlParts& u) {
+        for (;;) {
+            auto state = HostScheduler::Robots::Ready;
+            co_await loop.park([&](std::function<void()> wake) {
+                state = hosts.robots_begin(u, std::move(wake));
+                return state == HostScheduler::Robots::Loading;
+            });
+            if (state == HostScheduler::Robots::Ready) break;
+            if (state == HostScheduler::Robots::Loading) continue;   // woken: look again
+            std::string robots_url = std::string(u.origin()) + "/robots.txt";
+            std::string body;
+            PageRequest<std::string> req(robots_url, body, fetch);
+            bool ok = false;
+            if (req.begin()) ok = req.finish(co_await loop.perform(req.curl));
+            hosts.robots_done(u, ok, body);
+            break;
         }
+        co_return hosts.robots_check(u);
     }
+#endif // SPIDER_ASYNC
 };
 
 /* ===================== CLI parsing ===================== */
 
+// Benchmarks and other tools include this file with SPIDER_NO_MAIN.
+#ifndef SPIDER_NO_MAIN
+
 static void usage() {
     std::cout
         << "Usage: ./spider [-r] [-l N] [-p PATH] URL\n"
         << "  -r        recursive crawl\n"
         << "  -l N      max depth (only with -r). default 5\n"
-        << "  -p PATH   output directory (default ./data/)\n";
+        << "  -p PATH   output directory (default ./data/)\n"
+        << "  -j N      concurrent image downloads (default 8, 1 = serial)\n"
+        << "  -t N      crawl worker threads (default: number of cores)\n"
+        << "  --stream  parse pages as they arrive instead of buffering them\n"
+        << "  --compact-dedup  remember seen URLs as 64-bit fingerprints only\n"
+        << "  --host-conns N   parallel requests per host (default 8, 0 = unlimited)\n"
+        << "  --host-rps R     max requests per second per host (default unlimited)\n"
+        << "  --robots         fetch robots.txt once per host and obey it\n"
+        << "  --checkpoint F   journal progress to F and resume from it if it exists\n"
+        << "  --cache DIR      keep validators in DIR and re-crawl with conditional GETs\n"
+        << "  --cas            store images once per content hash under PATH/objects\n"
+        << "  --direct-io      write images with O_DIRECT (bypass the page cache)\n"
+        << "  --max-size N     abort images larger than N bytes (K/M/G suffixes)\n"
+        << "  --no-sniff       keep images whatever their Content-Type and magic bytes\n"
+        << "  --stats-interval S  print pages/s, images/s and MB/s every S seconds\n"
+        << "  --stats-json F   write counters and latency histograms to F as JSON (- = stdout)\n"
+        << "  --log-level L    debug, info (default), warn or error\n"
+        << "  --log-json       log one JSON object per line instead of text\n"
+        << "  --frontier-mem N keep at most N queued pages in memory, spill the rest to PATH/.frontier\n"
+        << "  --engine E       threads (default): blocking page fetches, one curl multi per thread\n"
+        << "                   for images; async: an epoll event loop per thread, pages and images\n"
+        << "                   as coroutines (Linux, C++20 builds)\n"
+        << "  --inflight N     with --engine async: transfers in flight per thread (default 1024)\n"
+#ifdef SPIDER_WITH_META
+        << "  --meta F         extract image metadata in memory while crawling, NDJSON to F\n"
+        << "  --meta-fields L  only these keys, comma-separated globs (see scorpion --fields)\n"
+        << "  --meta-jobs N    extractor threads (default: number of cores)\n"
+        << "  --meta-only      with --meta: do not keep the images on disk\n"
+        << "  --meta-range N   with --meta: fetch only the metadata part of JPEG/PNG images\n"
+        << "                   with Range requests of N bytes and up (images are not kept)\n"
+#endif
+        ;
 }
 
 static bool is_number(const std::string& s) {
@@ -395,10 +4263,26 @@ static bool is_number(const std::string& s) {
     return true;
 }
 
+// "512", "300K", "20M", "1G" -> bytes; -1 if malformed.
+static long long parse_size(const std::string& s) {
+    size_t digits = 0;
+    while (digits < s.size() && std::isdigit((unsigned char)s[digits])) ++digits;
+    if (digits == 0 || s.size() - digits > 1) return -1;
+    long long n = std::atoll(s.substr(0, digits).c_str());
+    if (digits == s.size()) return n;
+    switch (std::toupper((unsigned char)s[digits])) {
+    case 'K': return n << 10;
+    case 'M': return n << 20;
+    case 'G': return n << 30;
+    default:  return -1;
+    }
+}
+
 int main(int argc, char** argv) {
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
     Options opt;
+    opt.threads = (int)std::max(1u, std::thread::hardware_concurrency());
     std::string url;
 
     // Simple manual parsing (fits project constraints)
@@ -425,6 +4309,218 @@ int main(int argc, char** argv) {
                 return 1;
             }
             opt.out_dir = argv[++i];
+        } else if (a == "-j") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for -j\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n) || std::stoi(n) < 1) {
+                std::cerr << "Invalid value for -j: " << n << "\n";
+                return 1;
+            }
+            opt.jobs = std::stoi(n);
+        } else if (a == "-t") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for -t\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n) || std::stoi(n) < 1) {
+                std::cerr << "Invalid value for -t: " << n << "\n";
+                return 1;
+            }
+            opt.threads = std::stoi(n);
+        } else if (a == "--stream") {
+            opt.stream = true;
+        } else if (a == "--compact-dedup") {
+            opt.compact_dedup = true;
+        } else if (a == "--host-conns") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --host-conns\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n)) {
+                std::cerr << "Invalid value for --host-conns: " << n << "\n";
+                return 1;
+            }
+            opt.host_conns = std::stoi(n);
+        } else if (a == "--host-rps") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --host-rps\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            char* end = nullptr;
+            double r = std::strtod(n.c_str(), &end);
+            if (n.empty() || *end != '\0' || r < 0) {
+                std::cerr << "Invalid value for --host-rps: " << n << "\n";
+                return 1;
+            }
+            opt.host_rps = r;
+        } else if (a == "--robots") {
+            opt.robots = true;
+        } else if (a == "--checkpoint") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --checkpoint\n";
+                usage();
+                return 1;
+            }
+            opt.checkpoint = argv[++i];
+        } else if (a == "--cache") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --cache\n";
+                usage();
+                return 1;
+            }
+            opt.cache_dir = argv[++i];
+        } else if (a == "--cas") {
+            opt.cas = true;
+        } else if (a == "--direct-io") {
+            opt.direct_io = true;
+        } else if (a == "--stats-interval") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --stats-interval\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            char* end = nullptr;
+            double r = std::strtod(n.c_str(), &end);
+            if (n.empty() || *end != '\0' || r < 0) {
+                std::cerr << "Invalid value for --stats-interval: " << n << "\n";
+                return 1;
+            }
+            opt.stats_interval = r;
+        } else if (a == "--stats-json") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --stats-json\n";
+                usage();
+                return 1;
+            }
+            opt.stats_json = argv[++i];
+        } else if (a == "--log-level") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --log-level\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (n == "debug") opt.log_level = LogLevel::Debug;
+            else if (n == "info") opt.log_level = LogLevel::Info;
+            else if (n == "warn") opt.log_level = LogLevel::Warn;
+            else if (n == "error") opt.log_level = LogLevel::Error;
+            else {
+                std::cerr << "Invalid value for --log-level: " << n << "\n";
+                return 1;
+            }
+        } else if (a == "--log-json") {
+            opt.log_json = true;
+        } else if (a == "--frontier-mem") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --frontier-mem\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n)) {
+                std::cerr << "Invalid value for --frontier-mem: " << n << "\n";
+                return 1;
+            }
+            opt.frontier_mem = (size_t)std::stoull(n);
+        } else if (a == "--engine") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --engine\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (n == "threads") {
+                opt.async_engine = false;
+            } else if (n == "async") {
+#ifdef SPIDER_ASYNC
+                opt.async_engine = true;
+#else
+                std::cerr << "--engine async is not available in this build (needs C++20 on Linux)\n";
+                return 1;
+#endif
+            } else {
+                std::cerr << "Invalid value for --engine: " << n << "\n";
+                return 1;
+            }
+        } else if (a == "--inflight") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --inflight\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n) || std::stoull(n) < 1) {
+                std::cerr << "Invalid value for --inflight: " << n << "\n";
+                return 1;
+            }
+            opt.inflight = (size_t)std::stoull(n);
+#ifdef SPIDER_WITH_META
+        } else if (a == "--meta") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --meta\n";
+                usage();
+                return 1;
+            }
+            opt.meta_out = argv[++i];
+        } else if (a == "--meta-fields") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --meta-fields\n";
+                usage();
+                return 1;
+            }
+            opt.meta_fields = argv[++i];
+        } else if (a == "--meta-jobs") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --meta-jobs\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            if (!is_number(n) || std::stoi(n) < 1) {
+                std::cerr << "Invalid value for --meta-jobs: " << n << "\n";
+                return 1;
+            }
+            opt.meta_jobs = std::stoi(n);
+        } else if (a == "--meta-only") {
+            opt.meta_only = true;
+        } else if (a == "--meta-range") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --meta-range\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            opt.meta_range = parse_size(n);
+            if (opt.meta_range < 64) {
+                std::cerr << "Invalid value for --meta-range: " << n << " (at least 64 bytes)\n";
+                return 1;
+            }
+#endif
+        } else if (a == "--no-sniff") {
+            opt.sniff = false;
+        } else if (a == "--max-size") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --max-size\n";
+                usage();
+                return 1;
+            }
+            std::string n = argv[++i];
+            opt.max_size = parse_size(n);
+            if (opt.max_size < 0) {
+                std::cerr << "Invalid value for --max-size: " << n << "\n";
+                return 1;
+            }
         } else if (a == "-h" || a == "--help") {
             usage();
             return 0;
@@ -438,6 +4534,14 @@ int main(int argc, char** argv) {
         usage();
         return 1;
     }
+    if ((opt.meta_only || opt.meta_range > 0) && opt.meta_out.empty()) {
+        std::cerr << (opt.meta_only ? "--meta-only" : "--meta-range") << " needs --meta FILE\n";
+        return 1;
+    }
+    if (opt.async_engine && opt.stream) {
+        std::cerr << "--stream is not supported with --engine async\n";
+        return 1;
+    }
 
     // If -r is set and -l not provided => default depth 5
     if (opt.recursive && opt.max_depth == 0) {
@@ -459,17 +4563,30 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    Spider s;
-    s.opt = opt;
+    bool ok = true;
+    {
+        // scoped so every curl handle is released before curl_global_cleanup
+        Spider s;
+        s.opt = opt;
+        s.journaling = !opt.checkpoint.empty();
+
+        logger.min_level = opt.log_level;
+        logger.json = opt.log_json;
+        logger.start();
 
-    int depth = opt.recursive ? opt.max_depth : 0;
-    s.crawl(url, depth);
+        int depth = opt.recursive ? opt.max_depth : 0;
+        ok = s.crawl(url, depth);
+        logger.stop();
 
-    std::cerr << "\nDone.\n"
-              << "Visited pages: " << s.visited_pages.size() << "\n"
-              << "Downloaded images: " << s.downloaded_images.size() << "\n";
+        if (ok) {
+            std::cerr << "\nDone.\n"
+                      << "Visited pages: " << s.visited_pages.size() << "\n"
+                      << "Downloaded images: " << s.downloaded_images.size() << "\n";
+        }
+    }
 
     curl_global_cleanup();
-    return 0;
+    return ok ? 0 : 1;
 }
 
+#endif // SPIDER_NO_MAIN
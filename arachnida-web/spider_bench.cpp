@@ -0,0 +1,432 @@
+// Micro-benchmarks for the HTML extraction and URL helpers in spider.cpp.
+//
+//   ./spider_bench [--min-time S] [FILE|DIR ...]
+//
+// Each FILE (or every .html/.htm file under DIR) is one corpus page; with
+// no arguments a synthetic corpus of small, medium and large pages is
+// generated. Reports ns/op, MB/s and heap allocations per op, then the
+// throughput of each tag-scan kernel this CPU supports over the corpus.
+// A few fixed pages are scanned first, whole and byte by byte, and the
+// run fails if any of them does not give the expected references.
+
+#define SPIDER_NO_MAIN
+#include "spider.cpp"
+
+#include <iomanip>
+#include <new>
+#include <random>
+
+/* ===================== Allocation counting ===================== */
+
+static std::atomic<uint64_t> g_allocs{0};
+
+// Every form of operator new comes through here, so aligned and nothrow
+// allocations count the same as plain ones. Null on failure.
+static void* counted_alloc(std::size_t n, std::size_t align = 0) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (n == 0) n = 1;
+    if (align <= alignof(std::max_align_t)) return std::malloc(n);
+    // aligned_alloc wants a size that is a multiple of the alignment
+    return std::aligned_alloc(align, (n + align - 1) / align * align);
+}
+
+static void* counted_alloc_or_throw(std::size_t n, std::size_t align = 0) {
+    if (void* p = counted_alloc(n, align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t n) { return counted_alloc_or_throw(n); }
+void* operator new[](std::size_t n) { return counted_alloc_or_throw(n); }
+void* operator new(std::size_t n, std::align_val_t a) { return counted_alloc_or_throw(n, (std::size_t)a); }
+void* operator new[](std::size_t n, std::align_val_t a) { return counted_alloc_or_throw(n, (std::size_t)a); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n); }
+void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return counted_alloc(n, (std::size_t)a);
+}
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return counted_alloc(n, (std::size_t)a);
+}
+
+// malloc and aligned_alloc memory both go back through free()
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+/* ===================== Corpus ===================== */
+
+struct Page {
+    std::string name;
+    std::string html;
+};
+
+// Deterministic page of roughly `target` bytes: boilerplate head, nav
+// links, text with inline images and the quoting/casing mix real pages
+// have (unquoted, single quotes, upper-case tags, comments, scripts).
+static std::string synth_page(size_t target, uint32_t seed) {
+    std::mt19937 rng(seed);
+    auto pick = [&](int n) { return (int)(rng() % (unsigned)n); };
+    static const char* words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+        "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "magna"
+    };
+    static const char* exts[] = {".jpg", ".png", ".gif", ".jpeg", ".webp", ".svg", ".bmp"};
+
+    std::string h;
+    h.reserve(target + 1024);
+    h += "<!DOCTYPE html>\n<html lang=\"en\"><head><meta charset=\"utf-8\">\n"
+         "<title>Synthetic page</title>\n"
+         "<link rel=\"stylesheet\" href=\"/static/site.css\">\n"
+         "<script>window.dataLayer=[];function g(){dataLayer.push(arguments)}"
+         "var s='<img src=\"not-an-image.jpg\">';</script>\n"
+         "<style>body{font-family:sans-serif}.nav a{color:#333}</style>\n"
+         "</head><body>\n<div class=\"nav\">";
+    for (int i = 0; i < 12; ++i) {
+        h += "<a href=\"/section/" + std::to_string(i) + "/\">Section " + std::to_string(i) + "</a> ";
+    }
+    h += "</div>\n";
+
+    int n = 0;
+    while (h.size() < target) {
+        h += "<div class=\"item\" id=\"it" + std::to_string(n) + "\"><p>";
+        for (int w = 8 + pick(40); w > 0; --w) {
+            h += words[pick(16)];
+            h += ' ';
+        }
+        switch (pick(8)) {
+        case 0:
+            h += "<img src=\"/img/" + std::to_string(n) + exts[pick(7)] + "\" alt=\"photo\">";
+            break;
+        case 1:
+            h += "<IMG class='thumb' SRC='../thumbs/t" + std::to_string(n) + exts[pick(7)] + "?w=200&h=120'>";
+            break;
+        case 2:
+            h += "<img width=64 height=64 src=https://cdn.example.com/a/" + std::to_string(n) + ".png>";
+            break;
+        case 3:
+            h += "<a href=\"article-" + std::to_string(n) + ".html#comments\" title=\"read more\">more</a>";
+            break;
+        case 4:
+            h += "<a class=\"ext\" href='https://other.example.org/p?id=" + std::to_string(n) + "'>elsewhere</a>";
+            break;
+        case 5:
+            h += "<!-- <img src=\"commented-out.jpg\"> -->";
+            break;
+        case 6:
+            h += "<a href=\"./deep/../path/./x" + std::to_string(n) + "/\"><img src=\"icon.gif\"></a>";
+            break;
+        default:
+            h += "<span data-x=\"1\">" + std::string(words[pick(16)]) + "</span>";
+        }
+        h += "</p></div>\n";
+        ++n;
+    }
+    h += "</body></html>\n";
+    return h;
+}
+
+static bool load_corpus(const std::vector<std::string>& args, std::vector<Page>& pages) {
+    auto add = [&](const fs::path& p) {
+        std::string body;
+        if (read_file(p, body)) pages.push_back({p.filename().string(), std::move(body)});
+    };
+    for (const auto& a : args) {
+        std::error_code ec;
+        if (fs::is_directory(a, ec)) {
+            for (const auto& e : fs::recursive_directory_iterator(a, ec)) {
+                auto ext = e.path().extension().string();
+                if (e.is_regular_file() && (iequals(ext, ".html") || iequals(ext, ".htm"))) add(e.path());
+            }
+        } else if (fs::is_regular_file(a, ec)) {
+            add(a);
+        } else {
+            std::cerr << "Cannot read corpus entry: " << a << "\n";
+            return false;
+        }
+    }
+    if (args.empty()) {
+        pages.push_back({"synthetic-4K", synth_page(4 << 10, 1)});
+        pages.push_back({"synthetic-64K", synth_page(64 << 10, 2)});
+        pages.push_back({"synthetic-1M", synth_page(1 << 20, 3)});
+    }
+    std::sort(pages.begin(), pages.end(),
+              [](const Page& a, const Page& b) { return a.html.size() < b.html.size(); });
+    return !pages.empty();
+}
+
+// Every `<img ...>` / `<a ...>` tag of a page, for the per-tag extractor.
+static std::vector<std::string_view> collect_tags(std::string_view html, std::string_view name) {
+    std::vector<std::string_view> out;
+    for (size_t i = 0; (i = html.find('<', i)) != std::string_view::npos; ++i) {
+        if (i + 1 + name.size() >= html.size() || !istarts_with(html.substr(i + 1), name)) continue;
+        if (!is_html_space(html[i + 1 + name.size()])) continue;
+        size_t end = html.find('>', i);
+        if (end == std::string_view::npos) break;
+        out.push_back(html.substr(i, end - i + 1));
+    }
+    return out;
+}
+
+/* ===================== Harness ===================== */
+
+static double g_min_time = 0.3;
+static volatile size_t g_sink;
+
+struct Result {
+    std::string name;
+    uint64_t ops = 0;
+    double ns_per_op = 0;
+    double mb_per_s = 0;
+    double allocs_per_op = 0;
+};
+
+// Runs `body` (which performs `ops` operations over `bytes` input bytes
+// and returns a checksum) until g_min_time has passed.
+template <typename F>
+static Result bench(std::string name, size_t ops, size_t bytes, F&& body) {
+    g_sink = g_sink + body();   // warm-up
+
+    uint64_t reps = 0;
+    uint64_t allocs0 = g_allocs.load(std::memory_order_relaxed);
+    auto t0 = StatClock::now();
+    double secs = 0;
+    do {
+        g_sink = g_sink + body();
+        ++reps;
+        secs = (double)elapsed_ns(t0) / 1e9;
+    } while (secs < g_min_time);
+    uint64_t allocs = g_allocs.load(std::memory_order_relaxed) - allocs0;
+
+    Result r;
+    r.name = std::move(name);
+    r.ops = reps * ops;
+    r.ns_per_op = secs * 1e9 / (double)std::max<uint64_t>(1, r.ops);
+    r.mb_per_s = (double)(reps * bytes) / secs / 1e6;
+    r.allocs_per_op = (double)allocs / (double)std::max<uint64_t>(1, r.ops);
+    return r;
+}
+
+static void print_header() {
+    std::cout << std::left << std::setw(40) << "benchmark" << std::right
+              << std::setw(12) << "ops" << std::setw(12) << "ns/op"
+              << std::setw(10) << "MB/s" << std::setw(12) << "allocs/op" << "\n";
+}
+
+static void print(const Result& r) {
+    std::cout << std::left << std::setw(40) << r.name << std::right << std::fixed
+              << std::setw(12) << r.ops
+              << std::setw(12) << std::setprecision(1) << r.ns_per_op
+              << std::setw(10) << std::setprecision(1) << r.mb_per_s
+              << std::setw(12) << std::setprecision(2) << r.allocs_per_op << "\n";
+}
+
+/* ===================== Scanner checks ===================== */
+
+struct ScanCase {
+    const char* html;
+    const char* want;   // "I:url" / "L:url", space-separated, in document order
+};
+
+static const ScanCase scan_cases[] = {
+    {"<p><IMG SRC=\"a.png\"><a href='b.html'>b</a></p>", "I:a.png L:b.html"},
+    {"<img srcset=\"s1.jpg 1x, s2.jpg 2x\" data-src=lazy.jpg>", "I:s1.jpg I:s2.jpg I:lazy.jpg"},
+    {"<link rel=preload as=image href=hero.webp><a title=\"x>y\" href=q.html>", "I:hero.webp L:q.html"},
+    // an unclosed quote spoils only its own tag
+    {"<a title='it href=x.html>foo</a> <img src=late.png> <a href=z.html>", "L:x.html I:late.png L:z.html"},
+};
+
+static bool check_scanner() {
+    bool ok = true;
+    for (const auto& c : scan_cases) {
+        std::string whole, streamed;
+        auto into = [](std::string& out) {
+            return [&out](HtmlRef kind, std::string_view v) {
+                if (!out.empty()) out += ' ';
+                out += kind == HtmlRef::Image ? "I:" : "L:";
+                out.append(v);
+            };
+        };
+        std::string_view html = c.html;
+        scan_html(html, into(whole));
+        HtmlStreamScanner sc;
+        for (size_t i = 0; i < html.size(); ++i) sc.feed(html.substr(i, 1), into(streamed));
+        sc.finish(into(streamed));
+
+        for (const std::string* got : {&whole, &streamed}) {
+            if (*got == c.want) continue;
+            std::cerr << "scan_html" << (got == &whole ? "" : " (streamed)") << " on " << c.html
+                      << "\n  got:  " << *got << "\n  want: " << c.want << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/* ===================== Benchmarks ===================== */
+
+static void bench_extraction(const std::vector<Page>& pages) {
+    for (const auto& p : pages) {
+        std::string_view html = p.html;
+        std::string tag = "/" + p.name + " (" + std::to_string(html.size() >> 10) + "K)";
+
+        print(bench("extract_img_srcs" + tag, 1, html.size(), [&] {
+            return extract_img_srcs(html).size();
+        }));
+        print(bench("extract_a_hrefs" + tag, 1, html.size(), [&] {
+            return extract_a_hrefs(html).size();
+        }));
+
+        auto imgs = collect_tags(html, "img");
+        auto links = collect_tags(html, "a");
+        imgs.insert(imgs.end(), links.begin(), links.end());
+        if (imgs.empty()) continue;
+        size_t tag_bytes = 0;
+        for (auto t : imgs) tag_bytes += t.size();
+        print(bench("extract_attr_urls" + tag, imgs.size(), tag_bytes, [&] {
+            size_t n = 0;
+            for (auto t : imgs) n += extract_attr_urls(t, "src").size() + extract_attr_urls(t, "href").size();
+            return n;
+        }));
+    }
+}
+
+static void bench_urls(const std::vector<Page>& pages) {
+    auto base = parse_url("https://www.example.com/blog/2024/05/post.html?ref=home");
+    std::vector<std::string_view> refs;
+    for (const auto& p : pages) {
+        scan_html(p.html, [&](HtmlRef, std::string_view v) { refs.push_back(v); });
+    }
+    if (refs.empty() || !base) return;
+
+    std::vector<std::string> joined;
+    std::vector<std::string> images;
+    size_t ref_bytes = 0, joined_bytes = 0, image_bytes = 0;
+    for (auto r : refs) {
+        ref_bytes += r.size();
+        joined.push_back(join_url(*base, r));
+        joined_bytes += joined.back().size();
+        if (is_image_url(joined.back())) {
+            images.push_back(joined.back());
+            image_bytes += images.back().size();
+        }
+    }
+
+    print(bench("join_url", refs.size(), ref_bytes, [&] {
+        size_t n = 0;
+        for (auto r : refs) n += join_url(*base, r).size();
+        return n;
+    }));
+    // as the crawler does it: one join buffer per page, in the page arena
+    PageArena arena;
+    print(bench("join_url_to/arena", refs.size(), ref_bytes, [&] {
+        size_t n = 0;
+        arena.reset();
+        std::pmr::string out(arena.get());
+        for (auto r : refs) {
+            join_url_to(*base, r, out);
+            n += out.size();
+        }
+        return n;
+    }));
+    print(bench("parse_url", joined.size(), joined_bytes, [&] {
+        size_t n = 0;
+        for (const auto& u : joined) {
+            if (auto parts = parse_url(u)) n += parts->host().size();
+        }
+        return n;
+    }));
+    print(bench("is_image_url", joined.size(), joined_bytes, [&] {
+        size_t n = 0;
+        for (const auto& u : joined) n += is_image_url(u);
+        return n;
+    }));
+    if (images.empty()) return;
+    print(bench("filename_from_url", images.size(), image_bytes, [&] {
+        size_t n = 0;
+        for (const auto& u : images) n += filename_from_url(u).size();
+        return n;
+    }));
+}
+
+// find_tag_open() kernels against the scalar reference: same candidates
+// expected, throughput in GB/s over the whole corpus.
+static bool bench_tag_scan(const std::vector<Page>& pages) {
+    auto count = [&](TagScanFn fn, const std::string& html) {
+        size_t n = 0;
+        for (size_t i = 0; i < html.size(); ++i) {
+            i += fn(html.data() + i, html.size() - i);
+            n += i < html.size();
+        }
+        return n;
+    };
+    size_t bytes = 0, expect = 0;
+    for (const auto& p : pages) {
+        bytes += p.html.size();
+        expect += count(find_tag_open_scalar, p.html);
+    }
+
+    bool ok = true;
+    std::cout << "\ntag scan (" << tag_scan.name << " in use)\n";
+    for (const auto& k : tag_scan_kernels()) {
+        Result r = bench("tag_scan/" + std::string(k.name), pages.size(), bytes, [&] {
+            size_t n = 0;
+            for (const auto& p : pages) n += count(k.fn, p.html);
+            return n;
+        });
+        size_t got = 0;
+        for (const auto& p : pages) got += count(k.fn, p.html);
+        std::cout << std::left << std::setw(40) << r.name << std::right << std::fixed
+                  << std::setw(10) << std::setprecision(2) << r.mb_per_s / 1e3 << " GB/s"
+                  << std::setw(12) << got << " tags";
+        if (got != expect) {
+            std::cout << "  MISMATCH (scalar: " << expect << ")";
+            ok = false;
+        }
+        std::cout << "\n";
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--min-time") {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for --min-time\n";
+                return 1;
+            }
+            g_min_time = std::atof(argv[++i]);
+        } else if (a == "-h" || a == "--help") {
+            std::cout << "Usage: ./spider_bench [--min-time S] [FILE|DIR ...]\n";
+            return 0;
+        } else {
+            args.push_back(a);
+        }
+    }
+
+    if (!check_scanner()) return 1;
+
+    std::vector<Page> pages;
+    if (!load_corpus(args, pages)) {
+        std::cerr << "Empty corpus\n";
+        return 1;
+    }
+    size_t total = 0;
+    for (const auto& p : pages) total += p.html.size();
+    std::cout << "corpus: " << pages.size() << " pages, " << (total >> 10) << " KB\n\n";
+
+    print_header();
+    bench_extraction(pages);
+    bench_urls(pages);
+    return bench_tag_scan(pages) ? 0 : 1;
+}
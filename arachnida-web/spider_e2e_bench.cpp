@@ -0,0 +1,382 @@
+// End-to-end crawl benchmark against a synthetic site on loopback.
+//
+//   ./spider_e2e_bench [--pages N] [--images M] [--image-size BYTES]
+//                      [--latency MS] [--bandwidth KBPS] [--runs R]
+//                      [-t N] [-j N] [--host-conns N] [--frontier-mem N]
+//                      [--stream] [--cas] [--engine threads|async] [--inflight N]
+//
+// A forked child serves an N-page site (pages link as a tree with
+// `fanout` children each, M distinct JPEGs per page) over HTTP/1.1 with
+// keep-alive, an optional per-response latency and a per-connection
+// bandwidth cap. The parent runs Spider::crawl against it and reports
+// wall time, pages/s, images/s, MB/s, connections opened and peak RSS of
+// the crawler (the server lives in its own process).
+
+#define SPIDER_NO_MAIN
+#include "spider.cpp"
+
+#include <iomanip>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* ===================== Synthetic site ===================== */
+
+struct SiteConfig {
+    int pages = 200;
+    int images = 5;                 // per page
+    int fanout = 4;                 // child pages linked from each page
+    size_t image_size = 8 << 10;
+    int latency_ms = 0;             // added before every response
+    long bandwidth_kbps = 0;        // per connection, 0 = unlimited
+};
+
+// Counters the server child updates and the parent reads.
+struct ServerStats {
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+static std::string site_page(const SiteConfig& c, int i) {
+    std::string h = "<!DOCTYPE html><html><head><title>page " + std::to_string(i) +
+                    "</title></head><body>\n<a href=\"/p/0.html\">home</a>\n";
+    for (int k = 1; k <= c.fanout; ++k) {
+        long child = (long)i * c.fanout + k;
+        if (child < c.pages) h += "<a href=\"/p/" + std::to_string(child) + ".html\">child</a>\n";
+    }
+    for (int j = 0; j < c.images; ++j) {
+        h += "<p>item " + std::to_string(j) + "</p><img src=\"/img/" + std::to_string(i) + "-" +
+             std::to_string(j) + ".jpg\" alt=\"\">\n";
+    }
+    h += "</body></html>\n";
+    return h;
+}
+
+// A decodable 1x1 grayscale baseline JPEG, padded with COM segments (one
+// carrying `tag`, so every image has distinct content) to `size` bytes.
+static std::string site_jpeg(size_t size, const std::string& tag) {
+    static const unsigned char tail[] = {
+        // DQT: table 0, all ones
+        0xFF, 0xDB, 0x00, 0x43, 0x00,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        // SOF0: 8-bit, 1x1, one component (id 1, 1x1 sampling, table 0)
+        0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x01, 0x00, 0x01, 0x01, 0x01, 0x11, 0x00,
+        // DHT DC 0 and AC 0: a single 1-bit code each (DC category 0, EOB)
+        0xFF, 0xC4, 0x00, 0x14, 0x00, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00,
+        0xFF, 0xC4, 0x00, 0x14, 0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00,
+        // SOS, then the scan: DC "0", EOB "0", padded with ones
+        0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00,
+        0x3F,
+        0xFF, 0xD9,
+    };
+    std::string j = "\xFF\xD8";
+    auto com = [&](std::string_view body) {
+        size_t len = body.size() + 2;
+        j += "\xFF\xFE";
+        j += (char)(len >> 8);
+        j += (char)(len & 0xFF);
+        j += body;
+    };
+    com(tag);
+    size_t fixed = j.size() + sizeof(tail);
+    while (fixed < size) {
+        size_t room = size - fixed;
+        if (room < 4) break;   // a COM segment needs at least its 4-byte header
+        size_t body = std::min<size_t>(room - 4, 65533);
+        com(std::string(body, 'x'));
+        fixed += body + 4;
+    }
+    j.append(reinterpret_cast<const char*>(tail), sizeof(tail));
+    return j;
+}
+
+/* ===================== Loopback server ===================== */
+
+static bool send_all(int fd, const char* p, size_t n, long bandwidth_kbps) {
+    // throttled: 10 ms slices of the per-connection budget
+    size_t slice = bandwidth_kbps > 0 ? std::max<size_t>(1, (size_t)bandwidth_kbps * 1024 / 100) : n;
+    while (n > 0) {
+        size_t chunk = std::min(n, slice);
+        size_t off = 0;
+        while (off < chunk) {
+            ssize_t w = ::send(fd, p + off, chunk - off, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            off += (size_t)w;
+        }
+        p += chunk;
+        n -= chunk;
+        if (bandwidth_kbps > 0 && n > 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+static void serve_connection(int fd, const SiteConfig& c, ServerStats& st) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::string in;
+    char buf[8192];
+    for (;;) {
+        size_t end;
+        while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+            if (r <= 0) return;
+            in.append(buf, (size_t)r);
+        }
+        std::string req = in.substr(0, end);
+        in.erase(0, end + 4);
+
+        // "GET /path HTTP/1.1"
+        size_t sp1 = req.find(' '), sp2 = req.find(' ', sp1 + 1);
+        std::string path = sp1 == std::string::npos ? "" : req.substr(sp1 + 1, sp2 - sp1 - 1);
+        bool close_after = req.find("\r\nConnection: close") != std::string::npos ||
+                           req.find("HTTP/1.0") != std::string::npos;
+
+        int status = 404;
+        const char* type = "text/plain";
+        std::string body = "not found\n";
+        int a = 0, b = 0;
+        if (std::sscanf(path.c_str(), "/p/%d.html", &a) == 1 && a >= 0 && a < c.pages) {
+            status = 200;
+            type = "text/html; charset=utf-8";
+            body = site_page(c, a);
+        } else if (std::sscanf(path.c_str(), "/img/%d-%d.jpg", &a, &b) == 2 &&
+                   a >= 0 && a < c.pages && b >= 0 && b < c.images) {
+            status = 200;
+            type = "image/jpeg";
+            body = site_jpeg(c.image_size, path);
+        }
+
+        if (c.latency_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(c.latency_ms));
+        std::string head = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : " Not Found") +
+                           "\r\nContent-Type: " + type +
+                           "\r\nContent-Length: " + std::to_string(body.size()) +
+                           (close_after ? "\r\nConnection: close" : "") + "\r\n\r\n";
+        st.requests.fetch_add(1, std::memory_order_relaxed);
+        st.bytes.fetch_add(head.size() + body.size(), std::memory_order_relaxed);
+        if (!send_all(fd, head.data(), head.size(), c.bandwidth_kbps) ||
+            !send_all(fd, body.data(), body.size(), c.bandwidth_kbps) || close_after) {
+            return;
+        }
+    }
+}
+
+// Runs in the forked child until it is killed: one thread per connection.
+[[noreturn]] static void run_server(int listen_fd, const SiteConfig& c, ServerStats& st) {
+    for (;;) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            _exit(1);
+        }
+        st.connections.fetch_add(1, std::memory_order_relaxed);
+        std::thread([fd, &c, &st] {
+            serve_connection(fd, c, st);
+            ::close(fd);
+        }).detach();
+    }
+}
+
+static int open_listener(int& port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(fd, 1024) != 0 ||
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/* ===================== Benchmark ===================== */
+
+static bool parse_int_arg(int argc, char** argv, int& i, long& out) {
+    if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << argv[i] << "\n";
+        return false;
+    }
+    std::string n = argv[++i];
+    if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos) {
+        std::cerr << "Invalid value for " << argv[i - 1] << ": " << n << "\n";
+        return false;
+    }
+    out = std::atol(n.c_str());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    SiteConfig site;
+    Options opt;
+    opt.recursive = true;
+    opt.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    long runs = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        long v = 0;
+        if (a == "--stream") {
+            opt.stream = true;
+        } else if (a == "--cas") {
+            opt.cas = true;
+        } else if (a == "--engine" && i + 1 < argc) {
+            std::string e = argv[++i];
+            if (e == "async") {
+#ifdef SPIDER_ASYNC
+                opt.async_engine = true;
+#else
+                std::cerr << "--engine async is not available in this build\n";
+                return 1;
+#endif
+            } else if (e != "threads") {
+                std::cerr << "Invalid value for --engine: " << e << "\n";
+                return 1;
+            }
+        } else if (a == "-h" || a == "--help") {
+            std::cout << "Usage: ./spider_e2e_bench [--pages N] [--images M] [--image-size BYTES]\n"
+                         "         [--latency MS] [--bandwidth KBPS] [--runs R]\n"
+                         "         [-t N] [-j N] [--host-conns N] [--frontier-mem N]\n"
+                         "         [--stream] [--cas] [--engine threads|async] [--inflight N]\n";
+            return 0;
+        } else if (!parse_int_arg(argc, argv, i, v)) {
+            return 1;
+        } else if (a == "--pages" && v > 0) {
+            site.pages = (int)v;
+        } else if (a == "--images") {
+            site.images = (int)v;
+        } else if (a == "--image-size") {
+            site.image_size = (size_t)v;
+        } else if (a == "--latency") {
+            site.latency_ms = (int)v;
+        } else if (a == "--bandwidth") {
+            site.bandwidth_kbps = v;
+        } else if (a == "--runs" && v > 0) {
+            runs = v;
+        } else if (a == "-t" && v > 0) {
+            opt.threads = (int)v;
+        } else if (a == "-j" && v > 0) {
+            opt.jobs = (int)v;
+        } else if (a == "--host-conns") {
+            opt.host_conns = (int)v;
+        } else if (a == "--frontier-mem") {
+            opt.frontier_mem = (size_t)v;
+        } else if (a == "--inflight" && v > 0) {
+            opt.inflight = (size_t)v;
+        } else {
+            std::cerr << "Unknown or invalid option: " << a << "\n";
+            return 1;
+        }
+    }
+    // same combinations as spider itself accepts
+    if (opt.async_engine && opt.stream) {
+        std::cerr << "--stream is not supported with --engine async\n";
+        return 1;
+    }
+    // deep enough for the whole tree
+    opt.max_depth = site.pages;
+
+    int port = 0;
+    int listen_fd = open_listener(port);
+    if (listen_fd < 0) {
+        std::cerr << "Cannot listen on loopback\n";
+        return 1;
+    }
+    void* shared = mmap(nullptr, sizeof(ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return 1;
+    auto* st = new (shared) ServerStats();
+
+    // fork before any thread exists; the child only serves
+    pid_t child = fork();
+    if (child < 0) return 1;
+    if (child == 0) run_server(listen_fd, site, *st);
+    ::close(listen_fd);
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    logger.min_level = LogLevel::Warn;
+    logger.start();
+
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/p/0.html";
+    fs::path out = fs::temp_directory_path() / ("spider_e2e_" + std::to_string(getpid()));
+    uint64_t want_images = (uint64_t)site.pages * (uint64_t)site.images;
+
+    std::cout << "site: " << site.pages << " pages, " << site.images << " images/page of "
+              << site.image_size << " B, latency " << site.latency_ms << " ms, bandwidth "
+              << (site.bandwidth_kbps ? std::to_string(site.bandwidth_kbps) + " KB/s/conn" : "unlimited")
+              << "\ncrawler: -t " << opt.threads << " -j " << opt.jobs << " --host-conns " << opt.host_conns
+              << (opt.frontier_mem ? " --frontier-mem " + std::to_string(opt.frontier_mem) : "")
+              << (opt.stream ? " --stream" : "") << (opt.cas ? " --cas" : "")
+              << (opt.async_engine ? " --engine async --inflight " + std::to_string(opt.inflight) : "") << "\n\n";
+
+    bool all_ok = true;
+    double best = 0;
+    for (long r = 1; r <= runs; ++r) {
+        std::error_code ec;
+        fs::remove_all(out, ec);
+        fs::create_directories(out, ec);
+        opt.out_dir = out;
+        uint64_t conns0 = st->connections.load(), reqs0 = st->requests.load(), bytes0 = st->bytes.load();
+
+        auto t0 = StatClock::now();
+        size_t pages = 0, images = 0;
+        uint64_t failed = 0;
+        {
+            Spider s;
+            s.opt = opt;
+            if (!s.crawl(url, opt.max_depth)) all_ok = false;
+            pages = s.visited_pages.size();
+            images = s.downloaded_images.size();
+            failed = s.stats.pages_failed.load() + s.stats.images_failed.load();
+        }
+        double secs = (double)elapsed_ns(t0) / 1e9;
+        logger.stop();   // flush warnings before the report line
+        logger.start();
+
+        uint64_t conns = st->connections.load() - conns0;
+        uint64_t reqs = st->requests.load() - reqs0;
+        uint64_t bytes = st->bytes.load() - bytes0;
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                      "run %ld: %.3f s, %.1f pages/s, %.1f images/s, %.2f MB/s, %llu connections, %llu requests\n",
+                      r, secs, (double)pages / secs, (double)images / secs, (double)bytes / secs / 1e6,
+                      (unsigned long long)conns, (unsigned long long)reqs);
+        std::cout << line;
+        if (pages != (size_t)site.pages || images != want_images || failed) {
+            std::cout << "  !! incomplete crawl: " << pages << " pages, " << images << " images, "
+                      << failed << " failures\n";
+            all_ok = false;
+        }
+        best = r == 1 ? secs : std::min(best, secs);
+    }
+
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    std::cout << "\nbest: " << std::fixed << std::setprecision(3) << best << " s, "
+              << std::setprecision(1) << (double)site.pages / best << " pages/s\n"
+              << "peak RSS (crawler): " << std::setprecision(1) << (double)ru.ru_maxrss / 1024.0 << " MB\n";
+
+    logger.stop();
+    curl_global_cleanup();
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    std::error_code ec;
+    fs::remove_all(out, ec);
+    return all_ok ? 0 : 1;
+}